@@ -1,5 +1,5 @@
-from time import sleep
-import serial
+from time import sleep, time
+from crc import CRC
 
 """
 Read an Intel hex file, and, converting it into PIC-compatible code on the go, send it via I2C.
@@ -47,94 +47,136 @@ CMD_BUFFER_TO_FLASH = 0x05
 CMD_RUN_APPLICATION = 0x06
 CMD_READ_FROM_FLASH_SECOND_HALF = 0x07
 CMD_RESET = 0x08
+CMD_WRITE_ROW = 0x09
+CMD_READ_ROW_CRC = 0x0A
+CMD_VERIFY_APPLICATION = 0x0B
+CMD_SET_SLAVE_ADDRESS = 0x0C
+CMD_GET_STATUS = 0x0D
+CMD_ERASE_RANGE = 0x0E
+CMD_WRITE_ROW_RLE = 0x0F
+CMD_STREAM_READ = 0x10
+
+RLE_LITERAL = 0x00 #token types of CMD_WRITE_ROW_RLE, ORed with (number of words - 1)
+RLE_REPEAT = 0x40
+RLE_BLANK = 0x80
+RLE_MAX_WORDS = 32
+BLANK_WORD = 0x3FFF
+
+ROW_STATUS_OK = 0x00 #status bytes returned after CMD_WRITE_ROW
+ROW_STATUS_CRC_ERROR = 0x02
+ROW_STATUS_VERIFY_ERROR = 0x03
+ROW_STATUS_INCOMPLETE = 0x04
+ROW_STATUS_ADDRESS_ERROR = 0x05
+ROW_STATUS_BLANK_ERROR = 0x06 #verify_application(): application region is blank, nothing stored
+
+NVM_STATUS_DONE = 0x00 #returned by erase_from_flash(), nvm_status()
+NVM_STATUS_ERROR = 0x02
+
+#The bootloader holds SCL low while it erases or writes, so every answer arrives only once flash is ready; no sleeps needed.
 
 COM_PORT = 'COM3'
 
 I2C_SLAVE_ADDRESS = 0x1f #for first-level ESUM, current convention
+GENERAL_CALL_ADDRESS = 0x00 #all bootloaders accept CMD_WRITE_ROW on this address
 BUFFER_SIZE = 64
+MAX_READ_LENGTH = 32 #the Arduino can not read more bytes in one transaction
+MAX_WRITE_LENGTH = 32 #Wire buffer of the Arduino: longer writes are cut off
 """
 <<<<<<<<
 """
 
+def rle_encode(bytes_list): #row (LSByte, MSByte of each word) as CMD_WRITE_ROW_RLE tokens
+    words = [bytes_list[i] + 256*bytes_list[i + 1] for i in range(0, len(bytes_list), 2)]
+    encoded = []
+    i = 0
+    while i < len(words):
+        run = 1
+        while i + run < len(words) and run < RLE_MAX_WORDS and words[i + run] == words[i]:
+            run = run + 1
+        if words[i] == BLANK_WORD:
+            encoded.append(RLE_BLANK | (run - 1))
+        elif run > 1:
+            encoded += [RLE_REPEAT | (run - 1), words[i] % 256, words[i] // 256]
+        else: #literal up to the next blank word or repeated pair
+            run = 1
+            while i + run < len(words) and run < RLE_MAX_WORDS and words[i + run] != BLANK_WORD and not (i + run + 1 < len(words) and words[i + run] == words[i + run + 1]):
+                run = run + 1
+            encoded.append(RLE_LITERAL | (run - 1))
+            for word in words[i:i + run]:
+                encoded += [word % 256, word // 256]
+        i = i + run
+    return encoded
+
+ROW_CRC = CRC()
+
+def row_command(address, bytes_list, crc_value): #CMD_WRITE_ROW, or CMD_WRITE_ROW_RLE if that makes the transaction shorter; crc_value: CRC of the row data
+    encoded = rle_encode(bytes_list)
+    header = [address % 256, address // 256, ROW_CRC.CRC([address % 256, address // 256])] #address CRC: checked before the row is erased
+    command_crc = ROW_CRC.extend(crc_value, header[:2]) #the bootloader rejects a row whose address got corrupted
+    if len(encoded) < len(bytes_list):
+        return [CMD_WRITE_ROW_RLE] + header + encoded + [command_crc]
+    return [CMD_WRITE_ROW] + header + list(bytes_list) + [command_crc]
+
 class Arduino:
-    def __init__(self, address: int = 0x1f):
+    def __init__(self, address: int = 0x1f, port = COM_PORT):
+        import serial #only the serial bridge needs pyserial (see also i2cdev.py)
         # define Arduino COM port and speed
-        self.arduinoCom = COM_PORT
+        self.arduinoCom = port
         self.arduinoSpeed = 115200
         self.address = address
+        self.max_read_length = MAX_READ_LENGTH #longer reads are split
+        self.max_write_length = MAX_WRITE_LENGTH #longer row commands are sent as the old 7-transaction upload, see hexloader.upload_rows()
         self.arduino = serial.Serial(self.arduinoCom, self.arduinoSpeed, timeout=.1)
         sleep(2)
     def change_address(self, new_address):
         self.address = new_address
-    def send_two_bytes(self, byte1, byte2): #helpful to write to uploaded firmware (set flags, etc.)
-        command = f"I2CW 2 {hex(self.address)} {hex(byte1)} {hex(byte2)} \r"
-        #print(command)
-        self.arduino.write(command.encode())
+    """
+    Bus access: every method below goes through send_bytes_list(), read_bytes(), write_read() and read_byte().
+    Other transports (see i2cdev.py) only need to replace these.
+    """
     def send_bytes_list(self, bytes_list): #send all bytes in bytes_list from [0] to [-1]
         if(len(bytes_list) == 0):
             print("Attempted to send empty list.")
             return 0
         command = f"I2CW {len(bytes_list)} {hex(self.address)} " + " ".join(list(map(hex, bytes_list))) + " \r"
         self.arduino.write(command.encode())
-    def read_single_byte(self, position): #in firmware, go to given position, and read from it
-        self.send_command_byte(position) #send single byte
-        return self.read_byte()
-    def read_n_bytes(self, position, n): #in firmware, read n bytes starting from position
-        self.send_command_byte(position) #send single byte
+    def read_bytes(self, n): #read n bytes from the slave, returns list of int
         command = f"I2CR {n} {hex(self.address)} \r"
         self.arduino.write(command.encode())
-        for i in range(n):
-            readback = self.arduino.readline()
-            print(f"{i+1}: " + readback.decode().strip())
-    def send_command_byte(self, cmd_byte):
-        command = f"I2CW 1 {hex(self.address)} {hex(cmd_byte)} \r"
-        #print(command)
-        self.arduino.write(command.encode())
-    def read_byte(self):
+        return [int(self.arduino.readline().decode().rstrip(), 16) for i in range(n)]
+    def write_read(self, bytes_list, n): #write bytes_list, then read n bytes; a transport with combined transactions does this without a stop in between
+        self.send_bytes_list(bytes_list)
+        return self.read_bytes(n)
+    def read_byte(self): #raw answer line of the bridge (hex string, e.g. b"1F\r\n")
         command = f"I2CR 1 {hex(self.address)} \r"
         self.arduino.write(command.encode())
         readback = self.arduino.readline()
         return readback
+    def send_two_bytes(self, byte1, byte2): #helpful to write to uploaded firmware (set flags, etc.)
+        self.send_bytes_list([byte1, byte2])
+    def read_single_byte(self, position): #in firmware, go to given position, and read from it
+        self.send_command_byte(position) #send single byte
+        return self.read_byte()
+    def read_n_bytes(self, position, n): #in firmware, read n bytes starting from position
+        readback = self.write_read([position], n)
+        for i in range(n):
+            print(f"{i+1}: " + f"{readback[i]:X}")
+    def send_command_byte(self, cmd_byte):
+        self.send_bytes_list([cmd_byte])
     def set_flash_address(self, address): #bootloader takes LSByte first, then MSByte.
         #NOTE: address is words address; in hex file, bytes address = words address * 2 is given!
         LSByte = address % 256
         MSByte = int((address - LSByte) / 256)
-        command = f"I2CW 3 {hex(self.address)} {hex(CMD_SET_FLASH_ADDRESS)} {hex(LSByte)} {hex(MSByte)} \r"
-        self.arduino.write(command.encode())
+        self.send_bytes_list([CMD_SET_FLASH_ADDRESS, LSByte, MSByte])
     def write_to_buffer(self, bytes_list): #bytes_list should be list of int, always LSByte, then MSByte ([LSByte0, MSByte0, LSByte1, MSByte1, ..., LSByte15, MSByte15])
         #take 16 bytes, i.e. 8 words, write them to buffer
-        command = f"I2CW {len(bytes_list) + 1} {hex(self.address)} {hex(CMD_WRITE_TO_BUFFER)} "
-        for byte in bytes_list:
-            command = command + f"{hex(byte)} "
-        command = command + "\r"
-        #print(command)
-        self.arduino.write(command.encode())
-    """
-    def read_from_flash_memory(self): #returns list of int of form [MSB0, LSB0, MSB1, LSB1, ...]
-        self.send_command_byte(CMD_READ_FROM_FLASH)
-        command = f"I2CR {BUFFER_SIZE} {hex(self.address)} \r"
-        self.arduino.write(command.encode())
-        readback = self.arduino.read(256)
-        #readback = self.arduino.read(256).decode().split("\r\n") #first decode the b"" byte-string, then split into bytes. 256 bytes should be enough.
-        #return list(map(int, readback))
-        return readback
-    """
-    def read_first_half(self):
-        self.send_command_byte(CMD_READ_FROM_FLASH)
-        command = f"I2CR {BUFFER_SIZE} {hex(self.address)} \r"
-        self.arduino.write(command.encode())
-        readback = self.arduino.read(256).decode().rstrip().split("\r\n")
-        #readback = self.arduino.read(256).decode().split("\r\n") #first decode the b"" byte-string, then split into bytes. 256 bytes should be enough.
-        #return list(map(int, readback))
-        return [byte.rjust(2, "0") for byte in readback] #e.g. "0" -> "00", "A" -> "0A" etc.
+        self.send_bytes_list([CMD_WRITE_TO_BUFFER] + list(bytes_list))
+    def read_first_half(self): #hex strings of flash_buffer[0...31] ([MSB0, LSB0, MSB1, LSB1, ...]) after reading the row at the flash address
+        readback = self.write_read([CMD_READ_FROM_FLASH], MAX_READ_LENGTH)
+        return [f"{byte:02X}" for byte in readback] #e.g. 0x0A -> "0A"
     def read_second_half(self):
-        self.send_command_byte(CMD_READ_FROM_FLASH_SECOND_HALF)
-        command = f"I2CR {BUFFER_SIZE} {hex(self.address)} \r"
-        self.arduino.write(command.encode())
-        readback = self.arduino.read(256).decode().rstrip().split("\r\n")
-        return [byte.rjust(2, "0") for byte in readback] #e.g. "0" -> "00", "A" -> "0A" etc.
-        #readback = self.arduino.read(256).decode().split("\r\n") #first decode the b"" byte-string, then split into bytes. 256 bytes should be enough.
-        #return list(map(int, readback))
+        readback = self.write_read([CMD_READ_FROM_FLASH_SECOND_HALF], MAX_READ_LENGTH)
+        return [f"{byte:02X}" for byte in readback]
     def join_words(self, bytes_list):
         words_list = []
         i = 0
@@ -149,29 +191,78 @@ class Arduino:
         l = self.join_words(self.read_second_half())
         print(" ".join(l[:int(len(l)/2)]))
         print(" ".join(l[int(len(l)/2):]))
-    def buffer_to_flash(self):
+    def buffer_to_flash(self): #answer (CRC of buffer) arrives after the write
         self.send_command_byte(CMD_BUFFER_TO_FLASH)
-        sleep(0.005)
         return self.read_byte()
-    def erase_from_flash(self):
+    def erase_from_flash(self): #answer (NVM status) arrives after the erase
         self.send_command_byte(CMD_ERASE_ROW_FROM_FLASH)
-        sleep(0.005)
         return self.read_byte()
+    def nvm_status(self): #NVM_STATUS_DONE or NVM_STATUS_ERROR for the erase/write operations of the last command
+        return self.write_read([CMD_GET_STATUS], 1)[0]
+    def catch_bootloader(self, timeout = 10.0): #start, then power up (or reset) the module: an answer in the startup window of the bootloader keeps it from starting the application, e.g. a broken one. Returns True once caught
+        end = time() + timeout
+        while time() < end:
+            try:
+                if self.nvm_status() in (NVM_STATUS_DONE, NVM_STATUS_ERROR): #no module answers 0xFF (or not at all)
+                    return True
+            except (IOError, ValueError):
+                pass
+        return False
     def switch_to_program(self):
         self.send_command_byte(CMD_RUN_APPLICATION)
         return self.read_byte()
     def turn_on_firmware_leds(self, fw_addr):
         #set 0x52 to 0x01
-        command = f"I2CW 2 {hex(fw_addr)} 0x52 0x01 \r"
-        #print(command)
-        self.arduino.write(command.encode())
-    def erase_all(self, dt = 0.005):
-        flash_address = 0x1000
-        while flash_address < 0x1FFF:
-            self.set_flash_address(flash_address)
-            sleep(dt)
-            self.erase_from_flash()
-            flash_address = flash_address + 32 #1 row consists of 32 words.
+        own_address = self.address
+        self.change_address(fw_addr)
+        self.send_bytes_list([0x52, 0x01])
+        self.change_address(own_address)
+    def erase_range(self, first_row = 0x1000, n_rows = 0, poll_interval = 0.02): #erased on the device, blank rows skipped; n_rows = 0: up to 0x1FFF. Returns (NVM status, rows actually erased)
+        self.send_bytes_list([CMD_ERASE_RANGE, first_row % 256, first_row // 256, n_rows])
+        while True:
+            rows_left, rows_erased = self.read_bytes(2)
+            if rows_left == 0:
+                break
+            sleep(poll_interval)
+        return self.nvm_status(), rows_erased
+    def erase_all(self): #whole application region; returns NVM_STATUS_DONE or NVM_STATUS_ERROR
+        status, rows_erased = self.erase_range()
+        return status
+    def write_row(self, address, bytes_list, crc_value): #whole row in one transaction: address (LSByte, MSByte), address CRC, 64 data bytes (run-length coded if shorter), CRC of data and address. Needs max_write_length >= 69 for rows that do not compress.
+        return self.write_read(row_command(address, bytes_list, crc_value), 1)[0] #bootloader stretches the clock until erase, write and verify are done
+    def read_row_crcs(self, address, n_rows): #CRC of each of n_rows rows starting at (word) address, computed by the bootloader over flash
+        crcs = []
+        while n_rows > 0:
+            n = min(n_rows, self.max_read_length, 255) #number of rows is one byte
+            crcs += self.write_read([CMD_READ_ROW_CRC, address % 256, address // 256, n], n)
+            address = address + 32*n
+            n_rows = n_rows - n
+        return crcs
+    def read_flash(self, address, n_words): #n_words words starting at (word) address as a list of bytes (LSByte, MSByte of each word, as in hex_dict rows)
+        n_bytes = 2*n_words
+        n = min(n_bytes, self.max_read_length)
+        data = self.write_read([CMD_STREAM_READ, address % 256, address // 256], n)
+        n_bytes = n_bytes - n
+        while n_bytes > 0: #the bootloader keeps counting up between reads
+            n = min(n_bytes, self.max_read_length)
+            data += self.read_bytes(n)
+            n_bytes = n_bytes - n
+        return data
+    def verify_application(self, crc_value): #bootloader compares CRC of 0x1000-0x1FFF with crc_value, stores it on match (never for a blank region); returns (status, calculated CRC)
+        status, device_crc = self.write_read([CMD_VERIFY_APPLICATION, crc_value], 2)
+        return status, device_crc
+    def broadcast_row(self, address, bytes_list, crc_value): #CMD_WRITE_ROW(_RLE) to all bootloaders on the bus; no status, check with read_row_crcs() per module. Returns False (nothing sent) if the command is longer than max_write_length
+        command = row_command(address, bytes_list, crc_value)
+        if len(command) > self.max_write_length: #cut by the bridge, the modules would only erase the row
+            return False
+        own_address = self.address
+        self.change_address(GENERAL_CALL_ADDRESS)
+        self.send_bytes_list(command)
+        self.change_address(own_address)
+        return True
+    def set_bootloader_address(self, new_address): #stored on the module, used by its bootloader after the next reset. Only one module with the old address may be on the bus!
+        self.send_bytes_list([CMD_SET_SLAVE_ADDRESS, new_address])
+        return self.read_byte()
     def reset(self):
         self.send_command_byte(CMD_RESET)
         sleep(0.005)
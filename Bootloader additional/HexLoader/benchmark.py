@@ -0,0 +1,140 @@
+import argparse
+import contextlib
+import io
+import json
+import sys
+import time
+import hexloader
+from arduino import CMD_WRITE_ROW, CMD_WRITE_ROW_RLE, CMD_SET_FLASH_ADDRESS
+from i2cdev import I2CDev
+from hexfile import HexFile
+from image import Image
+from crc import CRC
+from simulator import SimBus, SimModule, SimUID
+from hexloader import upload_rows, changed_rows, transmit_row
+
+"""
+Upload benchmark against the simulated bootloader (simulator.py): python benchmark.py level1_firmware.hex firmware_v7.hex --ber 0 1e-5 1e-4
+
+For every image, bit-error rate, method and repetition, one upload to a fresh simulated module is timed and one JSON line is written
+(stdout or --output), so uploader or protocol changes can be compared run by run:
+    image, method, bit_error_rate, seed, rows, rows_failed, row_sends, retries_per_row, bus_bytes, bus_transfers, bit_errors,
+    seconds (simulated end-to-end time: bus, clock stretching, host delays), rows_per_second, wall_seconds, verified (application CRC, and no failed rows)
+A summary table goes to stderr.
+
+methods:
+    combined    upload_rows(): CMD_WRITE_ROW(_RLE), status, row CRC check on a lost status (what hexloader.py and fleet.py use)
+    legacy      transmit_row(): set address, erase, 4x CMD_WRITE_TO_BUFFER, CMD_WRITE_TO_FLASH, repeated while the returned CRC differs
+--base firmware_v6.hex: the module already holds this image, only changed rows are sent (delta update).
+Host delays (sleep() in hexloader.py) are added to the simulated clock instead of waiting.
+"""
+
+def load(fname):
+    if fname.endswith(".esim"):
+        return Image(fname)
+    hfile = HexFile(fname)
+    hfile.import_hex()
+    hfile.format_hex_dict()
+    hfile.fill_application()
+    return hfile
+
+class CountingI2CDev(I2CDev): #counts attempts to send a row (row command, or set address of transmit_row()), also those that got no ACK
+    def __init__(self, address, bus):
+        super().__init__(address, bus)
+        self.row_sends = 0
+    def send_bytes_list(self, bytes_list):
+        if len(bytes_list) > 0 and bytes_list[0] in (CMD_WRITE_ROW, CMD_WRITE_ROW_RLE, CMD_SET_FLASH_ADDRESS):
+            self.row_sends = self.row_sends + 1
+        return super().send_bytes_list(bytes_list)
+
+def upload_legacy(i2c, hfile, keys, crc, attempts = 10): #transmit_row() until the CRC of the written buffer matches; returns failed keys
+    failed = []
+    for key in keys:
+        row = list(hfile.hex_dict[key])
+        for i in range(attempts):
+            try:
+                if transmit_row(i2c, int(key, 16), row, 0) == hfile.row_crc(key, crc):
+                    break
+            except (IOError, ValueError):
+                pass
+        else:
+            failed.append(key)
+    return failed
+
+METHODS = {
+    "combined": lambda i2c, hfile, keys, crc: upload_rows(i2c, hfile, keys, crc),
+    "legacy": upload_legacy,
+}
+
+def preload(module: SimModule, fname): #module flash as after an upload of fname
+    words = load(fname).hex_dict
+    for key, row in words.items():
+        for i in range(32):
+            module.flash[int(key, 16) + i] = row[2*i] | (row[2*i + 1] << 8)
+
+def run(hfile, image_name, method, bit_error_rate, seed, base = None):
+    crc = CRC()
+    module = SimModule(seed = seed)
+    if base is not None:
+        preload(module, base)
+    bus = SimBus([module, SimUID()], bit_error_rate = bit_error_rate, seed = seed)
+    i2c = CountingI2CDev(0x1f, bus)
+    host_sleep = hexloader.sleep
+    hexloader.sleep = bus.advance #host delays on the simulated clock
+    wall = time.monotonic()
+    try:
+        with contextlib.redirect_stdout(io.StringIO()): #retry messages of the uploader
+            keys = list(hfile.hex_dict.keys())
+            if base is not None:
+                for attempt in range(10):
+                    try:
+                        keys = changed_rows(i2c, hfile, crc)
+                        break
+                    except (IOError, ValueError): #full upload if the device CRCs can not be read
+                        continue
+            failed = METHODS[method](i2c, hfile, keys, crc)
+    finally:
+        hexloader.sleep = host_sleep
+    wall = time.monotonic() - wall
+    seconds = bus.now
+    verified = module.mode == "bootloader" and module.application_crc() == hfile.application_crc(crc) and len(failed) == 0 #checked on the model, not over the noisy bus; a row the uploader gave up on fails the run
+    return {
+        "image": image_name, "method": method, "bit_error_rate": bit_error_rate, "seed": seed, "base": base,
+        "rows": len(keys), "rows_failed": len(failed), "row_sends": i2c.row_sends,
+        "retries_per_row": (i2c.row_sends - len(keys))/len(keys) if len(keys) > 0 else 0.0,
+        "bus_bytes": bus.bytes, "bus_transfers": bus.transfers, "bit_errors": bus.bit_errors,
+        "seconds": seconds, "rows_per_second": len(keys)/seconds if seconds > 0 else 0.0, "wall_seconds": wall, "verified": verified,
+    }
+
+def print_summary(results):
+    print(f"{'image':<22} {'method':<9} {'BER':>8} {'rows':>5} {'failed':>6} {'retry/row':>9} {'bytes':>7} {'time/s':>7} {'rows/s':>7} verified", file = sys.stderr)
+    for r in results:
+        print(f"{r['image']:<22} {r['method']:<9} {r['bit_error_rate']:>8.0e} {r['rows']:>5} {r['rows_failed']:>6} {r['retries_per_row']:>9.3f} {r['bus_bytes']:>7} "
+              f"{r['seconds']:>7.2f} {r['rows_per_second']:>7.1f} {r['verified']}", file = sys.stderr)
+
+def main():
+    parser = argparse.ArgumentParser(description = "Upload benchmark with fault injection against the simulated bootloader.")
+    parser.add_argument("images", nargs = "+", help = "hex files or .esim images")
+    parser.add_argument("--ber", nargs = "+", type = float, default = [0.0, 1e-5, 1e-4, 1e-3], help = "bit-error rates on the wire")
+    parser.add_argument("--methods", nargs = "+", choices = list(METHODS.keys()), default = list(METHODS.keys()))
+    parser.add_argument("--repeat", type = int, default = 3, help = "runs per combination, with seeds 0, 1, ...")
+    parser.add_argument("--base", help = "image already on the module (delta update)")
+    parser.add_argument("--output", help = "write the JSON lines to this file instead of stdout")
+    args = parser.parse_args()
+    results = []
+    output = open(args.output, "w") if args.output else sys.stdout
+    for fname in args.images:
+        hfile = load(fname)
+        for bit_error_rate in args.ber:
+            for method in args.methods:
+                for seed in range(args.repeat):
+                    result = run(hfile, fname, method, bit_error_rate, seed, args.base)
+                    results.append(result)
+                    output.write(json.dumps(result) + "\n")
+                    output.flush()
+    if args.output:
+        output.close()
+    print_summary(results)
+
+if __name__ == "__main__":
+    main()
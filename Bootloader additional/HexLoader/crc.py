@@ -50,3 +50,9 @@ class CRC:
             data = (message_list[i] ^ ((remainder >> (self.WIDTH - 8))%256))%256
             remainder = self.crcTable[data] ^ ((remainder << 8)%256)
         return (remainder ^ self.FINAL_XOR_VALUE)%256
+    def extend(self, crc_value, message_list): #CRC of the message crc_value was calculated over, followed by message_list
+        remainder = (crc_value ^ self.FINAL_XOR_VALUE)%256
+        for i in range(len(message_list)):
+            data = (message_list[i] ^ ((remainder >> (self.WIDTH - 8))%256))%256
+            remainder = self.crcTable[data] ^ ((remainder << 8)%256)
+        return (remainder ^ self.FINAL_XOR_VALUE)%256
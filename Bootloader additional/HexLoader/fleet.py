@@ -0,0 +1,129 @@
+import argparse
+import json
+from threading import Thread
+from time import time
+from arduino import Arduino, ROW_STATUS_OK, ROW_STATUS_BLANK_ERROR
+from i2cdev import I2CDev
+from hexfile import HexFile
+from image import Image
+from crc import CRC
+from hexloader import changed_rows, upload_rows, broadcast_upload
+from journal import Journal, image_hash, module_uid, resume_keys
+
+"""
+Upload one hex file (or image, see image.py) to many modules on several buses at once: python fleet.py inventory.json level2_firmware.hex
+
+Each bus (bridge or /dev/i2c-N) gets its own thread, the modules on one bus are programmed one after another
+(or all at once with "broadcast", see hexloader.broadcast_upload()). The whole upload takes as long as the slowest bus.
+
+Inventory (JSON): list of buses,
+[
+    {"name": "crate1", "transport": "arduino", "port": "COM3", "modules": ["0x1f"]},
+    {"name": "crate2", "transport": "arduino", "port": "/dev/ttyACM0", "modules": ["0x10", "0x11", "0x12"], "broadcast": true},
+    {"name": "crate3", "transport": "i2cdev", "port": 1, "modules": ["0x1f"]}
+]
+transport: arduino (ASCII bridge) or i2cdev (port is N of /dev/i2c-N).
+"""
+
+TRANSPORTS = {
+    "arduino": lambda port, address: Arduino(address, port),
+    "i2cdev": lambda port, address: I2CDev(address, int(port)),
+}
+
+def module_report(bus_name, address):
+    return {"bus": bus_name, "address": hex(address), "uid": None, "rows_sent": 0, "rows_failed": [], "application_crc": None, "seconds": 0.0, "error": None}
+
+def finish_module(i2c, report, hfile: HexFile, crc: CRC, start_application, journal = None, uid = None, image = None): #verify the application CRC, start the application
+    status, device_crc = i2c.verify_application(hfile.application_crc(crc))
+    report["application_crc"] = "verified" if status == ROW_STATUS_OK else "blank" if status == ROW_STATUS_BLANK_ERROR else f"mismatch (device {hex(device_crc)})"
+    if status != ROW_STATUS_BLANK_ERROR and journal is not None: #verified, or a mismatch: then the confirmed rows are not trusted any more, the next upload compares every row with the device
+        journal.finish(uid, image)
+    if start_application:
+        i2c.switch_to_program()
+
+def flash_bus(bus, hfile: HexFile, delta_update, start_application, reports, journal: Journal, image): #runs in its own thread; appends one report per module
+    crc = CRC()
+    addresses = [int(str(address), 0) for address in bus["modules"]]
+    bus_reports = [module_report(bus["name"], address) for address in addresses]
+    try:
+        i2c = TRANSPORTS[bus["transport"]](bus["port"], addresses[0])
+    except Exception as e: #bus not available: every module on it failed
+        for report in bus_reports:
+            report["error"] = f"bus: {e}"
+        reports.extend(bus_reports)
+        return
+    if bus.get("broadcast", False) and len(addresses) > 1:
+        start = time()
+        try:
+            uids = [module_uid(i2c, f"{bus['name']}-{hex(address)}", len(addresses)) for address in addresses] #same keys as the sequential upload
+            failed, sent = broadcast_upload(i2c, addresses, hfile, crc) #always a delta update: an interrupted broadcast continues by itself, no rows are journaled
+            for address, uid, report in zip(addresses, uids, bus_reports):
+                i2c.change_address(address)
+                report["uid"] = uid
+                report["rows_sent"] = sent[address]
+                report["rows_failed"] = failed[address]
+                finish_module(i2c, report, hfile, crc, start_application, journal, uid, image) #drops what an earlier sequential run left in the journal
+        except Exception as e:
+            for report in bus_reports:
+                report["error"] = str(e)
+        for report in bus_reports:
+            report["seconds"] = time() - start
+    else:
+        for address, report in zip(addresses, bus_reports):
+            start = time()
+            try:
+                i2c.change_address(address)
+                uid = module_uid(i2c, f"{bus['name']}-{hex(address)}", len(addresses))
+                report["uid"] = uid
+                keys = resume_keys(i2c, hfile, crc, journal, uid, image) #continued after the rows an interrupted run has confirmed
+                if delta_update:
+                    keys = changed_rows(i2c, hfile, crc, keys)
+                report["rows_sent"] = len(keys)
+                report["rows_failed"] = upload_rows(i2c, hfile, keys, crc, on_row_ok = lambda key: journal.confirm(uid, image, key))
+                finish_module(i2c, report, hfile, crc, start_application, journal, uid, image)
+            except Exception as e: #one module failing must not stop the others on the bus
+                report["error"] = str(e)
+            report["seconds"] = time() - start
+    i2c.close()
+    reports.extend(bus_reports)
+
+def print_report(reports):
+    print(f"{'bus':<12} {'module':<8} {'sent':>5} {'failed':>6} {'time/s':>7}  result")
+    for r in reports:
+        result = r["error"] if r["error"] is not None else f"application CRC {r['application_crc']}"
+        print(f"{r['bus']:<12} {r['address']:<8} {r['rows_sent']:>5} {len(r['rows_failed']):>6} {r['seconds']:>7.1f}  {result}")
+
+def main():
+    parser = argparse.ArgumentParser(description = "Upload a hex file to all modules of an inventory, one thread per bus.")
+    parser.add_argument("inventory", help = "JSON list of buses, see fleet.py")
+    parser.add_argument("hexfile", help = "hex file or precompiled .esim image")
+    parser.add_argument("--full", action = "store_true", help = "send every row, not only the ones that differ from the device")
+    parser.add_argument("--stay", action = "store_true", help = "do not start the application after the upload")
+    parser.add_argument("--report", help = "write the per-module report to this JSON file")
+    parser.add_argument("--journal", default = "upload_journal.json", help = "rows confirmed per module, an interrupted upload continues after them")
+    args = parser.parse_args()
+    with open(args.inventory, "r") as f:
+        inventory = json.load(f)
+    if args.hexfile.endswith(".esim"): #precompiled with image.py
+        hfile = Image(args.hexfile)
+    else:
+        hfile = HexFile(args.hexfile) #parsed once, only read by the threads
+        hfile.import_hex()
+        hfile.format_hex_dict()
+        hfile.fill_application()
+    journal = Journal(args.journal)
+    image = image_hash(hfile)
+    reports = [] #list.extend is atomic, no lock needed
+    threads = [Thread(target = flash_bus, args = (bus, hfile, not args.full, not args.stay, reports, journal, image)) for bus in inventory]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    reports.sort(key = lambda r: (r["bus"], r["address"]))
+    print_report(reports)
+    if args.report:
+        with open(args.report, "w") as f:
+            json.dump(reports, f, indent = 4)
+
+if __name__ == "__main__":
+    main()
@@ -111,3 +111,22 @@ class HexFile():
                 else:
                     lis.append(0xff)
             self.hex_dict[k] = lis
+    def fill_application(self, first_row = 0x1000, end = 0x2000): #keep only rows of the application region and add blank (0x3fff) rows, so that hex_dict covers the whole region in address order
+        dropped = [int(key, 16) for key in self.hex_dict.keys() if int(key, 16) < first_row or int(key, 16) >= end]
+        if len(dropped) == len(self.hex_dict):
+            raise ValueError(f"No rows in {hex(first_row)}-{hex(end - 1)} (rows {hex(min(dropped))}-{hex(max(dropped))}): the hex file is not linked for the application region (code offset 0x1000).")
+        if len(dropped) > 0: #e.g. configuration words, which the bootloader can not write
+            print(f"{len(dropped)} rows outside {hex(first_row)}-{hex(end - 1)} dropped (e.g. {hex(min(dropped))}).")
+        filled = {}
+        for row_index in range(first_row, end, 32):
+            filled[str(hex(row_index))] = self.hex_dict.get(str(hex(row_index)), [0xff, 0x3f]*32)
+        self.hex_dict = filled
+    def row_crc(self, key, crc): #CRC of a row as the bootloader calculates it (image.Image has it precomputed)
+        return crc.CRC(self.hex_dict[key])
+    def application_crc(self, crc): #CRC checked by COMMAND_VERIFY_APPLICATION
+        return crc.CRC(self.application_bytes())
+    def application_bytes(self): #all rows joined, as the bootloader calculates the application CRC over them
+        lis = []
+        for k in self.hex_dict.keys():
+            lis.extend(self.hex_dict[k])
+        return lis
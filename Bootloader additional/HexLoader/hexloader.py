@@ -1,14 +1,18 @@
-from arduino import Arduino
+from arduino import Arduino, ROW_STATUS_OK, ROW_STATUS_CRC_ERROR, ROW_STATUS_ADDRESS_ERROR, ROW_STATUS_BLANK_ERROR, row_command
+from i2cdev import I2CDev
 from hexfile import HexLine, HexFile
+from image import Image
+from journal import Journal, image_hash, module_uid, resume_keys
 from crc import CRC
 from time import sleep
 from random import random
+from queue import Queue
+from threading import Thread
 
 def transmit_row(i2c: Arduino, row_address: int, row, dt):
     i2c.set_flash_address(row_address)
     sleep(dt)
-    i2c.erase_from_flash()
-    sleep(dt)
+    i2c.erase_from_flash() #answer arrives once the row is erased
     i2c.write_to_buffer(row[:16])
     sleep(dt)
     i2c.write_to_buffer(row[16:32])
@@ -17,10 +21,125 @@ def transmit_row(i2c: Arduino, row_address: int, row, dt):
     sleep(dt)
     i2c.write_to_buffer(row[48:])
     sleep(dt)
-    crc_value = int(i2c.buffer_to_flash().decode().rstrip(), 16)
-    sleep(2*dt)
+    crc_value = int(i2c.buffer_to_flash().decode().rstrip(), 16) #answer arrives once the row is written
     return crc_value
 
+def transmit_row_combined(i2c: Arduino, row_address: int, row, crc_value): #erase, write and verify on the device in one command; returns ROW_STATUS_...
+    return i2c.write_row(row_address, row, crc_value)
+
+class Pacing: #delay before each bus command; grows on errors, shrinks back to dt_min after a run of successes
+    def __init__(self, dt_min = 0.0, dt_max = 0.05, dt_step = 0.001, successes_to_speed_up = 8):
+        self.dt_min = dt_min
+        self.dt_max = dt_max
+        self.dt_step = dt_step
+        self.successes_to_speed_up = successes_to_speed_up
+        self.dt = dt_min
+        self.successes = 0
+    def wait(self):
+        if self.dt > 0:
+            sleep(self.dt)
+    def ok(self):
+        self.successes = self.successes + 1
+        if self.successes >= self.successes_to_speed_up:
+            self.successes = 0
+            self.dt = self.dt / 2 if self.dt / 2 >= self.dt_step else self.dt_min
+    def error(self):
+        self.successes = 0
+        self.dt = min(self.dt_max, max(2*self.dt, self.dt_step))
+
+def prepare_rows(hfile: HexFile, keys, crc: CRC, depth = 4): #(address, row, CRC, command bytes) of each row, prepared in a background thread while the bus is busy
+    queue = Queue(depth)
+    def producer():
+        for key in keys:
+            row_address = int(key, 16)
+            row = hfile.hex_dict[key]
+            crc_value = hfile.row_crc(key, crc)
+            queue.put((row_address, row, crc_value, row_command(row_address, row, crc_value)))
+        queue.put(None)
+    Thread(target = producer, daemon = True).start()
+    while True:
+        item = queue.get()
+        if item is None:
+            return
+        yield item
+
+def upload_rows(i2c: Arduino, hfile: HexFile, keys, crc: CRC, pacing: Pacing = None, attempts = 10, on_row_ok = None, rechecks = 3): #row command for each key; only the failed step is repeated. Returns keys that could not be written; on_row_ok(key) is called for each confirmed row
+    if pacing is None:
+        pacing = Pacing()
+    failed = send_rows(i2c, hfile, keys, crc, pacing, attempts, on_row_ok)
+    for i in range(rechecks + 1): #the status byte has no CRC of its own: rows reported OK are checked on the device and sent again if they differ
+        differ = mismatched_rows(i2c, hfile, [key for key in keys if key not in failed], crc)
+        if len(differ) == 0 or i == rechecks:
+            break
+        print(f"{len(differ)} rows reported as written differ on the device. Re-submitting.")
+        failed = failed + send_rows(i2c, hfile, differ, crc, pacing, attempts, on_row_ok)
+    return failed + differ
+
+def mismatched_rows(i2c: Arduino, hfile: HexFile, keys, crc: CRC, attempts = 10): #keys whose row CRC on the device differs in two READ_ROW_CRC runs (a CRC corrupted on the way back rarely twice); all keys if the CRCs can not be read
+    if len(keys) == 0:
+        return []
+    addresses = [int(key, 16) for key in keys]
+    first = min(addresses)
+    differ = set(keys)
+    for run in range(2):
+        for i in range(attempts):
+            try:
+                device_crcs = i2c.read_row_crcs(first, (max(addresses) - first)//32 + 1)
+                break
+            except (IOError, ValueError):
+                continue
+        else:
+            return [key for key in keys if key in differ]
+        differ = {key for key, address in zip(keys, addresses) if key in differ and device_crcs[(address - first)//32] != hfile.row_crc(key, crc)}
+    return [key for key in keys if key in differ]
+
+def send_rows(i2c: Arduino, hfile: HexFile, keys, crc: CRC, pacing: Pacing, attempts, on_row_ok): #one pass of upload_rows(); returns keys that could not be written
+    failed = []
+    for row_address, row, crc_value, command in prepare_rows(hfile, keys, crc):
+        step = "send"
+        status = None
+        legacy = len(command) > i2c.max_write_length #row command does not fit into one write of the bridge: transmit_row() instead
+        for i in range(attempts):
+            pacing.wait()
+            try:
+                if legacy: #CRC of the written buffer, repeated as a whole
+                    status = ROW_STATUS_OK if transmit_row(i2c, row_address, row, pacing.dt) == crc_value else ROW_STATUS_CRC_ERROR
+                else:
+                    if step == "send":
+                        i2c.send_bytes_list(command)
+                        step = "status"
+                    if step == "status": #bootloader stretches the clock until the row is written and verified
+                        status = i2c.read_bytes(1)[0]
+                    else: #status got lost (and can only be read once): the row CRC on the device tells whether the row has been written
+                        status = ROW_STATUS_OK if i2c.read_row_crcs(row_address, 1)[0] == crc_value else ROW_STATUS_CRC_ERROR
+            except (IOError, ValueError): #NACK, corrupted or missing answer of the bridge
+                pacing.error()
+                if step == "status":
+                    step = "check"
+                continue
+            if status == ROW_STATUS_OK:
+                pacing.ok()
+                if on_row_ok is not None:
+                    on_row_ok(hex(row_address))
+                break
+            pacing.error()
+            if status == ROW_STATUS_ADDRESS_ERROR and not (0x1000 <= row_address < 0x2000 and row_address % 32 == 0): #repeating does not help; for a valid row the address got corrupted on the wire
+                break
+            print(f"Line {hex(row_address)} status {hex(status)} detected. Re-submitting. #{i}")
+            step = "send"
+        if status != ROW_STATUS_OK: #e.g. ROW_STATUS_ADDRESS_ERROR for an address corrupted on the wire: the row CRC on the device decides
+            try:
+                if i2c.read_row_crcs(row_address, 1)[0] == crc_value:
+                    status = ROW_STATUS_OK
+                    if on_row_ok is not None:
+                        on_row_ok(hex(row_address))
+            except (IOError, ValueError):
+                pass
+        if status != ROW_STATUS_OK:
+            print(f"Line {hex(row_address)} could not be written (status {status}). WARNING: This means the uploaded firmware will probably not work properly.")
+            failed.append(hex(row_address))
+    return failed
+
 def make_noisy(data, p = 0.2):
     noisy_data = data
     for i in range(8):
@@ -35,8 +154,7 @@ def noisy_transmit_row(i2c: Arduino, row_address: int, row_data, dt):
             row[i] = make_noisy(row[i])
     i2c.set_flash_address(row_address)
     sleep(dt)
-    i2c.erase_from_flash()
-    sleep(dt)
+    i2c.erase_from_flash() #answer arrives once the row is erased
     i2c.write_to_buffer(row[:16])
     sleep(dt)
     i2c.write_to_buffer(row[16:32])
@@ -45,69 +163,136 @@ def noisy_transmit_row(i2c: Arduino, row_address: int, row_data, dt):
     sleep(dt)
     i2c.write_to_buffer(row[48:])
     sleep(dt)
-    crc_value = int(i2c.buffer_to_flash().decode().rstrip(), 16)
-    sleep(2*dt)
+    crc_value = int(i2c.buffer_to_flash().decode().rstrip(), 16) #answer arrives once the row is written
     return crc_value
 
-def erase_all(i2c, dt = 0.005):
-    flash_address = 0x1000
-    while flash_address < 0x1FFF:
-        i2c.set_flash_address(flash_address)
-        sleep(dt)
-        i2c.erase_from_flash()
-        flash_address = flash_address + 32 #1 row consists of 32 words.
+def changed_rows(i2c: Arduino, hfile: HexFile, crc: CRC, keys = None): #those of keys (default: all rows) whose CRC on the device differs from the hex file (hex_dict must cover the application region, see HexFile.fill_application())
+    all_keys = list(hfile.hex_dict.keys())
+    if keys is None:
+        keys = all_keys
+    if len(keys) == 0:
+        return []
+    span = all_keys[all_keys.index(keys[0]):all_keys.index(keys[-1]) + 1] #only the range from the first to the last of keys is read, e.g. after the rows an interrupted upload has confirmed
+    device_crcs = i2c.read_row_crcs(int(span[0], 16), len(span))
+    wanted = set(keys)
+    changed = []
+    for key, device_crc in zip(span, device_crcs):
+        if key in wanted and device_crc != hfile.row_crc(key, crc):
+            changed.append(key)
+    return changed
+
+def broadcast_upload(i2c: Arduino, module_addresses, hfile: HexFile, crc: CRC, attempts = 10): #program all modules at once; returns {module address: list of row keys that could not be written}, {module address: number of rows sent to it}
+    changed = set()
+    for address in module_addresses: #rows that differ on any of the modules
+        i2c.change_address(address)
+        changed.update(changed_rows(i2c, hfile, crc))
+    broadcast = 0
+    for key in hfile.hex_dict.keys(): #each row is sent once; the bootloaders hold SCL low until the row is committed (i2c.c), so the next row waits for the slowest module
+        if key in changed: #rows whose command does not fit into one write of the bridge are left to upload_rows() below, module by module
+            row = hfile.hex_dict[key]
+            if i2c.broadcast_row(int(key, 16), row, hfile.row_crc(key, crc)):
+                broadcast = broadcast + 1
+    failed = {}
+    sent = {}
+    for address in module_addresses: #nothing is read back after a broadcast: the row CRCs of every module are checked (read_row_crcs), rows that differ are repeated to that module only
+        i2c.change_address(address)
+        repeat = changed_rows(i2c, hfile, crc)
+        upload_rows(i2c, hfile, repeat, crc, attempts = attempts)
+        failed[address] = changed_rows(i2c, hfile, crc) #read back once more, a row only counts as written when its CRC on the device matches
+        sent[address] = broadcast + len(repeat)
+    return failed, sent
+
+def erase_all(i2c):
+    return i2c.erase_all() #done by the bootloader with a single command
 
 def main():
     """
     Don't forget to check the appropriate COM port (i.e., if the Arduino is on COM3, make sure COM_PORT in arduino.py is "COM3")
     """
     crc = CRC()
-    dt = 0.005 #Still experimenting with waiting time after each step.
+    dt = 0.005 #pacing of the old 7-transaction upload; the row command adapts its pacing to the errors it sees (see Pacing)
+    delta_update = True #only rows whose CRC on the device differs are sent; False: send every row of the hex file. Both skip the rows the journal has confirmed for this module and image
+    use_row_command = True #False: old 7-transaction upload (set address, erase, 4x write to buffer, buffer to flash); upload_rows() also falls back to it for rows longer than the bridge can send (max_write_length)
     i2c = Arduino(0x1f) #as of june 2020, bootloader i2c address is the same for all stages
+    #i2c = I2CDev(0x1f, 1) #without the Arduino: /dev/i2c-1 of a Raspberry Pi, see i2cdev.py
+    module_addresses = [0x1f] #more than one: all modules are programmed at once via broadcast (give each bootloader its own address first, see Arduino.set_bootloader_address())
     #hfile = HexFile("firmware_v7.hex") #stage 1
-    hfile = HexFile("level2_firmware.hex") #stages 2 and 3
+    hfile = HexFile("level2_firmware.hex") #stages 2 and 3; must be linked with code offset 0x1000, fill_application() refuses a file without rows in the application region
+    #hfile = Image("level2_firmware.esim") #precompiled with image.py: no parsing, CRCs stored; then skip the three lines below
 
     hfile.import_hex()
     hfile.format_hex_dict()
-    for key in hfile.hex_dict.keys(): #since python 3.7, this assures iterating through the keys (flash mamory addresses) in insertion order. Not that it matters much, anyway.
-        row_address = int(key, 16)
-        row = hfile.hex_dict[key]
-        #print(hex(row_address))
-        #print(list(map(hex,row)))
-        #input()
-        crc_calculated = crc.CRC(row)
-        i = 0
-        while i < 10:
-            #crc_val = transmit_row(i2c, row_address, row, dt)
-            crc_val = noisy_transmit_row(i2c, row_address, row, dt)
-            if crc_val != crc_calculated:
-                if i < 9:
-                    print(f"Line {hex(row_address)} CRC mismatch detected (received {crc_val}, expected {crc_calculated}). Re-submitting. #{i}")
-                    i = i + 1
+    hfile.fill_application() #rows not in the hex file are written blank, otherwise the application CRC would not match
+    if len(module_addresses) > 1:
+        failed, sent = broadcast_upload(i2c, module_addresses, hfile, crc)
+        for address in module_addresses:
+            i2c.change_address(address)
+            status, device_crc = i2c.verify_application(hfile.application_crc(crc))
+            print(f"Module {hex(address)}: {sent[address]} rows sent, {len(failed[address])} rows failed, application CRC {'verified' if status == ROW_STATUS_OK else 'BLANK' if status == ROW_STATUS_BLANK_ERROR else 'MISMATCH'}.")
+            i2c.switch_to_program()
+        return
+    journal = Journal() #rows confirmed so far, an interrupted upload continues after them
+    image = image_hash(hfile)
+    uid = module_uid(i2c, hex(i2c.address)) #UID EEPROM of the module, if it can be read
+    keys = resume_keys(i2c, hfile, crc, journal, uid, image)
+    if delta_update:
+        keys = changed_rows(i2c, hfile, crc, keys)
+        print(f"{len(keys)} of {len(hfile.hex_dict)} rows differ from the device.")
+    if use_row_command: #next rows are prepared while the current one is written, failed steps are repeated on their own
+        upload_rows(i2c, hfile, keys, crc, on_row_ok = lambda key: journal.confirm(uid, image, key))
+    else:
+        for key in keys: #since python 3.7, this assures iterating through the keys (flash mamory addresses) in insertion order. Not that it matters much, anyway.
+            row_address = int(key, 16)
+            row = hfile.hex_dict[key]
+            #print(hex(row_address))
+            #print(list(map(hex,row)))
+            #input()
+            crc_calculated = crc.CRC(row)
+            i = 0
+            while i < 10:
+                #crc_val = transmit_row(i2c, row_address, row, dt)
+                crc_val = noisy_transmit_row(i2c, row_address, row, dt)
+                row_ok = (crc_val == crc_calculated)
+                error_text = f"CRC mismatch (received {crc_val}, expected {crc_calculated})"
+                if not row_ok:
+                    if i < 9:
+                        print(f"Line {hex(row_address)} {error_text} detected. Re-submitting. #{i}")
+                        i = i + 1
+                    else:
+                        print(f"Line {hex(row_address)} {error_text} could not be resolved within 10 attempts. Continuing with next line. WARNING: This means the uploaded firmware will probably not work properly.")
+                        break
                 else:
-                    print(f"Line {hex(row_address)} CRC mismatch could not be resolved within 10 attempts. Continuing with next line. WARNING: This means the uploaded firmware will probably not work properly.")
                     break
-            else:
-                break
-        """
-        i2c.set_flash_address(row_address)
-        sleep(dt)
-        i2c.erase_from_flash()
-        sleep(dt)
-        i2c.write_to_buffer(row[:16])
-        sleep(dt)
-        i2c.write_to_buffer(row[16:32])
-        sleep(dt)
-        i2c.write_to_buffer(row[32:48])
-        sleep(dt)
-        i2c.write_to_buffer(row[48:])
-        sleep(dt)
-        crc_lis.append(i2c.buffer_to_flash())
-        sleep(2*dt)
-        """
+            """
+            i2c.set_flash_address(row_address)
+            sleep(dt)
+            i2c.erase_from_flash()
+            sleep(dt)
+            i2c.write_to_buffer(row[:16])
+            sleep(dt)
+            i2c.write_to_buffer(row[16:32])
+            sleep(dt)
+            i2c.write_to_buffer(row[32:48])
+            sleep(dt)
+            i2c.write_to_buffer(row[48:])
+            sleep(dt)
+            crc_lis.append(i2c.buffer_to_flash())
+            sleep(2*dt)
+            """
+    status, device_crc = i2c.verify_application(hfile.application_crc(crc))
+    if status == ROW_STATUS_OK:
+        journal.finish(uid, image)
+        print("Application CRC verified, the module will start the firmware on every boot (after a 100 ms I2C window of the bootloader).")
+    elif status == ROW_STATUS_BLANK_ERROR:
+        print("WARNING: the application region of the module is blank, no CRC stored. The module will stay in the bootloader.")
+    else:
+        journal.finish(uid, image) #confirmed rows are not trusted any more, the next upload compares every row with the device
+        print(f"WARNING: application CRC mismatch (device calculated {hex(device_crc)}). The module will stay in the bootloader.")
     sleep(dt)
     i2c.switch_to_program()
-main()
+
+if __name__ == "__main__":
+    main()
 
 """
 TODO other than hexloader:
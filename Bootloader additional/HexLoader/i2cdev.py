@@ -0,0 +1,63 @@
+import ctypes
+import fcntl
+import os
+from arduino import Arduino
+
+"""
+Direct I2C access through Linux i2c-dev (/dev/i2c-N), e.g. on a Raspberry Pi, instead of the Arduino serial bridge.
+I2CDev has the same interface as Arduino, so it can be passed to everything in hexloader.py and test_at_cb.py.
+
+Write and read of one command are sent as a single I2C_RDWR transaction (repeated start, no stop in between).
+NOTE: the bootloader signals busy by clock stretching. The hardware I2C of the Raspberry Pi does not handle long stretches
+correctly; use the i2c-gpio overlay (dtoverlay=i2c-gpio) for programming.
+
+For tests without hardware, pass any object with transfer(address, write_bytes, read_length) and close() as bus.
+"""
+
+I2C_RDWR = 0x0707 #ioctl number, linux/i2c-dev.h
+I2C_M_RD = 0x0001 #message flag: read, linux/i2c.h
+
+class i2c_msg(ctypes.Structure):
+    _fields_ = [("addr", ctypes.c_uint16), ("flags", ctypes.c_uint16), ("len", ctypes.c_uint16), ("buf", ctypes.POINTER(ctypes.c_uint8))]
+
+class i2c_rdwr_ioctl_data(ctypes.Structure):
+    _fields_ = [("msgs", ctypes.POINTER(i2c_msg)), ("nmsgs", ctypes.c_uint32)]
+
+class I2CBus:
+    def __init__(self, bus_number: int = 1):
+        self.fd = os.open(f"/dev/i2c-{bus_number}", os.O_RDWR)
+    def transfer(self, address, write_bytes, read_length): #write write_bytes (if any), then read read_length bytes (if any) in one transaction; returns list of int
+        msgs = []
+        write_buffer = (ctypes.c_uint8 * len(write_bytes))(*write_bytes)
+        read_buffer = (ctypes.c_uint8 * read_length)()
+        if len(write_bytes) > 0:
+            msgs.append(i2c_msg(address, 0, len(write_bytes), write_buffer))
+        if read_length > 0:
+            msgs.append(i2c_msg(address, I2C_M_RD, read_length, read_buffer))
+        if len(msgs) == 0:
+            return []
+        msg_array = (i2c_msg * len(msgs))(*msgs)
+        fcntl.ioctl(self.fd, I2C_RDWR, i2c_rdwr_ioctl_data(msg_array, len(msgs)))
+        return list(read_buffer)
+    def close(self):
+        os.close(self.fd)
+
+class I2CDev(Arduino):
+    def __init__(self, address: int = 0x1f, bus = 1): #bus: number N of /dev/i2c-N, or a stand-in object (see above)
+        self.address = address
+        self.max_read_length = 8192 #i2c-dev limit per message
+        self.max_write_length = 8192
+        self.bus = I2CBus(bus) if isinstance(bus, int) else bus
+    def send_bytes_list(self, bytes_list):
+        if(len(bytes_list) == 0):
+            print("Attempted to send empty list.")
+            return 0
+        self.bus.transfer(self.address, list(bytes_list), 0)
+    def read_bytes(self, n):
+        return self.bus.transfer(self.address, [], n)
+    def write_read(self, bytes_list, n):
+        return self.bus.transfer(self.address, list(bytes_list), n)
+    def read_byte(self): #same format as the answer line of the serial bridge
+        return f"{self.read_bytes(1)[0]:X}\r\n".encode()
+    def close(self):
+        self.bus.close()
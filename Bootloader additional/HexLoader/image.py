@@ -0,0 +1,125 @@
+import mmap
+import struct
+import sys
+from hexfile import HexLine
+from crc import CRC
+
+"""
+Precompiled upload image: python image.py level2_firmware.hex level2_firmware.esim
+
+The hex file is parsed once; the image holds the application rows as they are sent to the bootloader, with their CRCs.
+Image (below) maps the file and has the same interface as a HexFile after fill_application(), so it can be used
+everywhere in hexloader.py and fleet.py without parsing or CRC calculation at upload time.
+
+File layout (little endian):
+header, 16 bytes:
+    magic "ESIM", version, number of row blocks (2 bytes), first word of the region (2 bytes), end of the region (2 bytes),
+    application CRC (whole region, blank rows included, as checked by COMMAND_VERIFY_APPLICATION),
+    image CRC (all row blocks), header CRC (bytes 0-12), 2 bytes reserved (0)
+row block, 68 bytes, in address order:
+    row word address (2 bytes), row CRC, reserved (0), 64 data bytes (LSByte, MSByte of each word)
+Rows that are completely blank (0x3FFF) are not stored. Words outside the region (bootloader, User ID, config words) are
+dropped when compiling; config words can only be changed with a programmer anyway.
+"""
+
+IMAGE_MAGIC = b"ESIM"
+IMAGE_VERSION = 1
+HEADER_FORMAT = "<4sBHHHBBB2x"
+HEADER_SIZE = 16
+BLOCK_HEADER_FORMAT = "<HBx"
+BLOCK_SIZE = 68
+ROW_WORDS = 32
+BLANK_ROW = bytes([0xff, 0x3f]*ROW_WORDS)
+
+def read_hex_words(fname): #{word address: word} of all data records, extended linear addresses applied
+    words = {}
+    upper = 0
+    with open(fname, "r") as f:
+        for line in f:
+            if line[0] != ":":
+                continue
+            hline = HexLine(line)
+            if hline.calculate_checksum() != hline.checksum:
+                raise ValueError(f"Checksum error in line {line.rstrip()}")
+            if hline.type == 1: #end of file
+                break
+            if hline.type == 4: #extended linear address: upper 16 bits of the byte address
+                upper = (hline.data[0] << 8 | hline.data[1]) << 16
+                continue
+            if hline.type != 0:
+                continue
+            byte_address = upper + hline.address
+            for i, byte in enumerate(hline.data):
+                word_address = (byte_address + i) // 2
+                word = words.get(word_address, 0x3fff)
+                if (byte_address + i) % 2: #MSByte
+                    word = (word & 0xff) | ((byte & 0x3f) << 8)
+                else:
+                    word = (word & 0x3f00) | byte
+                words[word_address] = word
+    return words
+
+def compile_hex(hex_fname, image_fname, first_row = 0x1000, end = 0x2000): #returns number of rows stored
+    crc = CRC()
+    words = read_hex_words(hex_fname)
+    dropped = [address for address in words if address < first_row or address >= end]
+    if len(dropped) == len(words):
+        raise ValueError(f"No words in {hex(first_row)}-{hex(end - 1)}: {hex_fname} is not linked for the application region (code offset 0x1000).")
+    if len(dropped) > 0:
+        print(f"{len(dropped)} words outside {hex(first_row)}-{hex(end - 1)} dropped (e.g. {hex(min(dropped))}).")
+    blocks = []
+    application = []
+    for row_address in range(first_row, end, ROW_WORDS):
+        row = []
+        for address in range(row_address, row_address + ROW_WORDS):
+            word = words.get(address, 0x3fff)
+            row += [word & 0xff, word >> 8]
+        application += row
+        if bytes(row) != BLANK_ROW:
+            blocks.append(struct.pack(BLOCK_HEADER_FORMAT, row_address, crc.CRC(row)) + bytes(row))
+    body = b"".join(blocks)
+    header = struct.pack(HEADER_FORMAT, IMAGE_MAGIC, IMAGE_VERSION, len(blocks), first_row, end, crc.CRC(application), crc.CRC(body), 0)
+    header = header[:13] + bytes([crc.CRC(header[:13])]) + header[14:]
+    with open(image_fname, "wb") as f:
+        f.write(header)
+        f.write(body)
+    return len(blocks)
+
+class Image:
+    def __init__(self, fname, check = True): #check: verify the image CRC over all row blocks
+        self.fname = fname
+        crc = CRC()
+        with open(fname, "rb") as f:
+            self.map = mmap.mmap(f.fileno(), 0, access = mmap.ACCESS_READ)
+        view = memoryview(self.map)
+        magic, version, n_rows, self.first_row, self.end, self.app_crc, image_crc, header_crc = struct.unpack(HEADER_FORMAT, view[:HEADER_SIZE])
+        if magic != IMAGE_MAGIC or version != IMAGE_VERSION or header_crc != crc.CRC(view[:13]):
+            raise ValueError(f"{fname} is not a valid upload image.")
+        if len(view) != HEADER_SIZE + n_rows*BLOCK_SIZE or (check and crc.CRC(view[HEADER_SIZE:]) != image_crc):
+            raise ValueError(f"{fname} is damaged.")
+        stored = {}
+        self.crcs = {}
+        for i in range(n_rows):
+            offset = HEADER_SIZE + i*BLOCK_SIZE
+            row_address, row_crc = struct.unpack(BLOCK_HEADER_FORMAT, view[offset:offset + 4])
+            stored[row_address] = view[offset + 4:offset + BLOCK_SIZE] #no copy, read from the mapped file when sent
+            self.crcs[str(hex(row_address))] = row_crc
+        blank_crc = crc.CRC(BLANK_ROW)
+        self.hex_dict = {} #same keys and order as HexFile.fill_application()
+        for row_address in range(self.first_row, self.end, ROW_WORDS):
+            key = str(hex(row_address))
+            self.hex_dict[key] = stored.get(row_address, BLANK_ROW)
+            self.crcs.setdefault(key, blank_crc)
+    def row_crc(self, key, crc: CRC = None): #precomputed
+        return self.crcs[key]
+    def application_crc(self, crc: CRC = None): #precomputed
+        return self.app_crc
+    def application_bytes(self):
+        return b"".join(self.hex_dict.values())
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: python image.py firmware.hex firmware.esim")
+    else:
+        n_rows = compile_hex(sys.argv[1], sys.argv[2])
+        print(f"{n_rows} rows written to {sys.argv[2]}.")
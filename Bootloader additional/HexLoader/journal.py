@@ -0,0 +1,80 @@
+import hashlib
+import json
+import os
+from threading import Lock
+
+"""
+Progress journal for resumable uploads: rows confirmed by the bootloader (ROW_STATUS_OK or row CRC) are recorded per module UID and
+image hash. After an interrupted upload (bridge dropped, module reset), the next upload of the same image to the same module
+checks the last confirmed rows on the device and continues after them, see resume_keys().
+The journal is a small JSON file, rewritten (atomically) after every row; entries are removed once the application CRC is verified.
+"""
+
+UID_ADDRESS = 0x51 #UID EEPROM on the ESUM board (see test_at_cb.readUID())
+UID_REGISTER = 0xFA
+UID_LENGTH = 6
+
+def image_hash(hfile): #SHA-256 of the whole application region as uploaded (HexFile or image.Image)
+    return hashlib.sha256(bytes(hfile.application_bytes())).hexdigest()
+
+def module_uid(i2c, default, modules_on_bus = 1): #UID of the module's EEPROM, or default if it can not be read. The UID EEPROMs of all boards answer at UID_ADDRESS, so with more than one module on the bus the read would mix their UIDs: default (bus and module address) then
+    if modules_on_bus > 1:
+        return default
+    own_address = i2c.address
+    try:
+        i2c.change_address(UID_ADDRESS)
+        uid = i2c.write_read([UID_REGISTER], UID_LENGTH)
+    except (IOError, ValueError):
+        return default
+    finally:
+        i2c.change_address(own_address)
+    if len(uid) != UID_LENGTH or all(byte == 0xff for byte in uid): #nobody answered
+        return default
+    return "".join(f"{byte:02X}" for byte in uid)
+
+class Journal:
+    def __init__(self, fname = "upload_journal.json"):
+        self.fname = fname
+        self.lock = Lock() #shared by the bus threads of fleet.py
+        self.entries = {}
+        if os.path.exists(fname):
+            with open(fname, "r") as f:
+                self.entries = json.load(f)
+    def key(self, uid, image):
+        return f"{uid}/{image}"
+    def confirmed(self, uid, image): #row keys confirmed so far, in the order they were written
+        with self.lock:
+            return list(self.entries.get(self.key(uid, image), []))
+    def confirm(self, uid, image, row_key):
+        with self.lock:
+            rows = self.entries.setdefault(self.key(uid, image), [])
+            if row_key not in rows:
+                rows.append(row_key)
+            self.save()
+    def forget(self, uid, image, row_keys):
+        with self.lock:
+            rows = self.entries.get(self.key(uid, image), [])
+            self.entries[self.key(uid, image)] = [row for row in rows if row not in row_keys]
+            self.save()
+    def finish(self, uid, image): #upload complete and verified, or application CRC mismatch (nothing confirmed can be trusted then)
+        with self.lock:
+            self.entries.pop(self.key(uid, image), None)
+            self.save()
+    def save(self): #called with the lock held
+        temp_fname = self.fname + ".tmp"
+        with open(temp_fname, "w") as f:
+            json.dump(self.entries, f)
+        os.replace(temp_fname, self.fname) #an interruption leaves either the old or the new journal
+
+def resume_keys(i2c, hfile, crc, journal: Journal, uid, image, check_last = 4): #rows of hfile still to be sent; the last check_last confirmed rows are checked on the device first
+    confirmed = journal.confirmed(uid, image)
+    suspect = []
+    for key in confirmed[-check_last:]: #a reset during or right after these may have left them damaged
+        if i2c.read_row_crcs(int(key, 16), 1)[0] != hfile.row_crc(key, crc):
+            suspect.append(key)
+    if len(suspect) > 0:
+        journal.forget(uid, image, suspect)
+    done = set(confirmed) - set(suspect)
+    if len(done) > 0:
+        print(f"Resuming: {len(done)} rows already confirmed on module {uid}.")
+    return [key for key in hfile.hex_dict.keys() if key not in done]
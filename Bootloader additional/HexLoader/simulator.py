@@ -0,0 +1,761 @@
+import os
+import random
+import select
+import sys
+import time
+import tty
+from crc import CRC
+from arduino import (CMD_SET_FLASH_ADDRESS, CMD_WRITE_TO_BUFFER, CMD_READ_FROM_FLASH, CMD_ERASE_ROW_FROM_FLASH, CMD_BUFFER_TO_FLASH,
+    CMD_RUN_APPLICATION, CMD_READ_FROM_FLASH_SECOND_HALF, CMD_RESET, CMD_WRITE_ROW, CMD_READ_ROW_CRC, CMD_VERIFY_APPLICATION,
+    CMD_SET_SLAVE_ADDRESS, CMD_GET_STATUS, CMD_ERASE_RANGE, CMD_WRITE_ROW_RLE, CMD_STREAM_READ, RLE_LITERAL, RLE_REPEAT, RLE_BLANK,
+    ROW_STATUS_OK, ROW_STATUS_CRC_ERROR, ROW_STATUS_VERIFY_ERROR, ROW_STATUS_INCOMPLETE, ROW_STATUS_ADDRESS_ERROR, ROW_STATUS_BLANK_ERROR,
+    NVM_STATUS_DONE, NVM_STATUS_ERROR, GENERAL_CALL_ADDRESS)
+
+"""
+Protocol-level simulator of an ESUM module (bootloader of Bootloader.X/i2c.c and register map of EnergySum.X/ESUM.c)
+for testing and benchmarking the host tools without hardware.
+
+Direct use: SimBus has the transfer() method of i2cdev.I2CBus, so I2CDev(0x1f, bus) talks to the simulated modules.
+Over a pseudo-terminal: python simulator.py [--fast] [--modules N]
+    prints the pty path, use it as port of Arduino (ASCII bridge).
+
+Timing: SimBus keeps a virtual clock (bytes at 100 kHz plus erase, write and CRC times of the PIC, plus the time the
+firmware needs for its flags). With realtime (default for the pty server), every transfer also takes that long.
+"""
+
+BYTE_TIME = 9/100e3 #8 bits + ACK at 100 kHz
+ROW_ERASE_TIME = 2.5e-3 #datasheet TPE/TPEW
+ROW_WRITE_TIME = 2.5e-3
+WORD_READ_TIME = 5e-6 #flash read and CRC of one word
+BLANK_WORD = 0x3FFF
+APPLICATION_START = 0x1000
+APPLICATION_END = 0x2000
+USER_ID_START = 0x8000 #bootloader flag, application CRC, bootloader address
+USER_ID_MARKER = 0x2A
+BOOTLOADER_FLAG_LEAVE = 0x0001
+BOOTLOADER_FLAG_STAY = 0x0000
+HANDOFF_STAY = 0x5AA5
+HANDOFF_LEAVE = 0xA55A
+BOOTLOADER_ADDRESS = 0x1f
+BOOTLOADER_TIMEOUT = 27*60 #T0 settings of the bootloader
+STARTUP_WINDOW = 0.1 #startup_window_ms: I2C is served before an application with valid CRC is started
+
+#ESUM register map, see EnergySum.X/main.h
+MDAC_FLAG = 24
+ODAC_FLAG = 0x20
+ODAC_MSB = 0x21
+ADC_FLAG = 0x30
+ADC_MSB = 0x31
+UID_FLAG = 0x40
+UID_STORE = 0x41
+TP_FLAG = 0x50
+BL_FLAG = 0x51
+LED_FLAG = 0x52
+I2C_FLAG = 0x53
+I2C_STORE = 0x54
+BT_FLAG = 0x60
+BT_DEADBAND = 0x61
+BT_STEP = 0x62
+BT_INTERVAL = 0x63
+BT_LIMIT = 0x64
+BT_CORR_MSB = 0x65
+BT_AVG_MSB = 0x67
+BT_CODE_MSB = 0x69
+RESET_FLAG = 0xbb
+VERSION_REGISTER = 0xff
+VERSION_NUMBER = 0x07
+BASELINE_ADC_VALUE = 0x024D
+UID_ADDRESS = 0x51
+UID_REGISTER = 0xFA
+
+class SimModule:
+    """
+    One PIC16F18345 with bootloader and ESUM firmware. Flash holds only words (0x0000-0x1FFF and the User IDs),
+    the firmware itself is not executed: once the bootloader starts the application, the register map of ESUM.c is simulated.
+    """
+    def __init__(self, app_address = 0x2e, level = 2, seed = None):
+        self.crc = CRC()
+        self.app_address = app_address #i2c_default_address of the firmware
+        self.n_mdacs = 24
+        self.random = random.Random(seed)
+        self.flash = {}
+        self.user_id = [BLANK_WORD, BLANK_WORD, BLANK_WORD]
+        self.handoff = self.random.randrange(0x10000) #RAM after power-up
+        self.adc_offset = 0.0 #drift of the baseline, in ADC counts (tracking test)
+        self.reset_count = 0
+        self.power_on(0.0)
+    """
+    Boot and mode changes
+    """
+    def power_on(self, now):
+        self.handoff = self.random.randrange(0x10000)
+        self.boot(now, power_on = True)
+    def boot(self, now, power_on = False): #bootloader main() up to its main loop
+        self.reset_count = self.reset_count + 1
+        self.mode = "bootloader"
+        self.bl_reset_state()
+        self.application_corrupt = False
+        self.last_activity = now
+        handoff = self.handoff
+        self.handoff = 0
+        if power_on: #nPOR cleared: the handoff in RAM is random and not used
+            handoff = 0
+        if handoff == HANDOFF_LEAVE:
+            return self.leave_bootloader(now)
+        flag = BOOTLOADER_FLAG_STAY
+        if handoff != HANDOFF_STAY:
+            flag = self.user_id[0]
+        if flag == BOOTLOADER_FLAG_LEAVE:
+            return self.leave_bootloader(now)
+        if flag != BOOTLOADER_FLAG_STAY:
+            crc_word = self.user_id[1]
+            if (crc_word >> 8) == USER_ID_MARKER:
+                if (crc_word & 0xff) == self.application_crc():
+                    self.startup_window = now + STARTUP_WINDOW #StartupWindow(): left in bl_tick() unless a transaction starts
+                    return
+                self.application_corrupt = True
+    def leave_bootloader(self, now):
+        self.user_id[0] = BLANK_WORD #flash_memory_set_bootloader_flag(bootloader_flag_none)
+        self.mode = "application"
+        self.app_init(now)
+    def addresses(self):
+        if self.mode == "bootloader":
+            word = self.user_id[2]
+            return [word & 0x7f if (word >> 8) == USER_ID_MARKER else BOOTLOADER_ADDRESS, GENERAL_CALL_ADDRESS]
+        return [self.memory[I2C_STORE]]
+    def tick(self, now):
+        if self.mode == "bootloader":
+            self.bl_tick(now)
+        else:
+            self.app_tick(now)
+    def write(self, address, data, now): #returns busy time (clock stretching)
+        if self.mode == "bootloader":
+            return self.bl_write(address, data, now)
+        return self.app_write(data, now)
+    def read(self, address, n, now): #returns (bytes, busy time)
+        if self.mode == "bootloader":
+            return self.bl_read(n, now)
+        return self.app_read(n), 0.0
+    def stop(self, now):
+        if self.mode == "bootloader":
+            self.i2c_status = "initial"
+    """
+    Flash
+    """
+    def flash_read(self, address):
+        if address >= USER_ID_START:
+            return self.user_id[address - USER_ID_START] if address - USER_ID_START < len(self.user_id) else BLANK_WORD
+        return self.flash.get(address, BLANK_WORD)
+    def flash_erase(self, address): #returns busy time; the lower half is write protected (WRT = HALF)
+        if address < APPLICATION_START or address >= APPLICATION_END:
+            self.nvm_status = NVM_STATUS_ERROR
+            return 0.0
+        for a in range(address & ~0x1f, (address & ~0x1f) + 32):
+            self.flash.pop(a, None)
+        return ROW_ERASE_TIME
+    def flash_write_row(self, address, buffer): #programming only clears bits
+        if address < APPLICATION_START or address >= APPLICATION_END:
+            self.nvm_status = NVM_STATUS_ERROR
+            return 0.0
+        for i in range(32):
+            word = buffer[2*i] | ((buffer[2*i + 1] & 0x3f) << 8)
+            self.flash[address + i] = self.flash_read(address + i) & word
+        return ROW_WRITE_TIME
+    def update_user_id(self, index, value):
+        if self.user_id[index] == value:
+            return 0.0
+        self.user_id[index] = value
+        return ROW_ERASE_TIME + ROW_WRITE_TIME
+    def row_crc(self, address):
+        data = []
+        for a in range(address, address + 32):
+            word = self.flash_read(a)
+            data += [word & 0xff, word >> 8]
+        return self.crc.CRC(data)
+    def application_bytes(self):
+        data = []
+        for a in range(APPLICATION_START, APPLICATION_END):
+            word = self.flash_read(a)
+            data += [word & 0xff, word >> 8]
+        return data
+    def application_crc(self):
+        return self.crc.CRC(self.application_bytes())
+    """
+    Bootloader (Bootloader.X/i2c.c)
+    """
+    def bl_reset_state(self):
+        self.i2c_status = "initial"
+        self.control_word = 0
+        self.flash_address = 0
+        self.address_index = 0
+        self.buffer = [0]*64
+        self.buffer_index = 0
+        self.buffer_address = 0 #flash_address when the latches were loaded
+        self.row_complete = False
+        self.row_address_ok = False
+        self.startup_window = None #end of the I2C window before the application is started
+        self.row_crc_received = 0
+        self.crc_rows_left = 0
+        self.app_crc_calculated = 0
+        self.broadcast = False
+        self.new_slave_address = 0
+        self.nvm_status = NVM_STATUS_DONE
+        self.erase_address = 0
+        self.erase_rows_left = 0
+        self.erase_rows_erased = 0
+        self.erase_time = 0.0
+        self.rle_type = 0
+        self.rle_words_left = 0
+        self.rle_lsb = None
+        self.stream_word = None
+        self.last_byte = 0xff
+    def row_address_valid(self):
+        return (self.flash_address & 0x1f) == 0 and APPLICATION_START <= self.flash_address < APPLICATION_END
+    def buffer_byte(self, data):
+        if self.buffer_index == 0:
+            self.buffer_address = self.flash_address
+        self.buffer[self.buffer_index] = data
+        self.buffer_index = self.buffer_index + 1
+    def decode_byte(self, data): #I2C_DecodeByte()
+        if self.rle_words_left == 0:
+            self.rle_type = data & 0xe0
+            self.rle_words_left = (data & 0x1f) + 1
+            self.rle_lsb = None
+            if self.rle_type == RLE_BLANK:
+                while self.rle_words_left and self.buffer_index < 64:
+                    self.buffer_byte(0xff)
+                    self.buffer_byte(0x3f)
+                    self.rle_words_left = self.rle_words_left - 1
+                self.rle_words_left = 0
+            elif self.rle_type not in (RLE_LITERAL, RLE_REPEAT):
+                self.rle_words_left = 0
+            return
+        if self.rle_type == RLE_LITERAL:
+            self.buffer_byte(data)
+            if self.buffer_index % 2 == 0:
+                self.rle_words_left = self.rle_words_left - 1
+        elif self.rle_lsb is None:
+            self.rle_lsb = data
+        else:
+            while self.rle_words_left and self.buffer_index < 64:
+                self.buffer_byte(self.rle_lsb)
+                self.buffer_byte(data)
+                self.rle_words_left = self.rle_words_left - 1
+            self.rle_words_left = 0
+    def write_row(self): #I2C_WriteRow(), returns (status, busy time)
+        if not self.row_complete:
+            return ROW_STATUS_INCOMPLETE, 0.0
+        self.row_complete = False
+        if not self.row_address_ok:
+            return ROW_STATUS_ADDRESS_ERROR, 0.0
+        if self.crc.CRC(self.buffer + [self.flash_address & 0xff, self.flash_address >> 8]) != self.row_crc_received:
+            return ROW_STATUS_CRC_ERROR, 0.0
+        busy = self.flash_write_row(self.flash_address, self.buffer) + 32*WORD_READ_TIME
+        for i in range(32):
+            if self.flash_read(self.flash_address + i) != (self.buffer[2*i] | ((self.buffer[2*i + 1] & 0x3f) << 8)):
+                return ROW_STATUS_VERIFY_ERROR, busy
+        return ROW_STATUS_OK, busy
+    def bl_tick(self, now):
+        if self.startup_window is not None and now >= self.startup_window:
+            return self.leave_bootloader(now)
+        if self.erase_rows_left > 0: #I2C_EraseStep() in the main loop
+            while self.erase_rows_left > 0 and self.erase_time <= now:
+                blank = all(self.flash_read(a) == BLANK_WORD for a in range(self.erase_address, self.erase_address + 32))
+                self.erase_time = self.erase_time + 32*WORD_READ_TIME
+                if not blank:
+                    self.erase_time = self.erase_time + self.flash_erase(self.erase_address)
+                    self.erase_rows_erased = self.erase_rows_erased + 1
+                self.erase_address = self.erase_address + 32
+                self.erase_rows_left = self.erase_rows_left - 1
+            self.last_activity = now
+        if not self.application_corrupt and now - self.last_activity > BOOTLOADER_TIMEOUT:
+            self.leave_bootloader(now)
+    def bl_write(self, address, data, now):
+        self.last_activity = now
+        self.startup_window = None
+        self.i2c_status = "address"
+        self.broadcast = (address == GENERAL_CALL_ADDRESS)
+        busy = 0.0
+        for byte in data:
+            busy = busy + self.bl_write_byte(byte)
+        return busy
+    def bl_write_byte(self, byte):
+        if self.i2c_status == "address":
+            if self.broadcast and byte not in (CMD_WRITE_ROW, CMD_WRITE_ROW_RLE):
+                self.i2c_status = "initial"
+                return 0.0
+            self.control_word = byte
+            self.i2c_status = "control"
+            self.address_index = 0
+            if byte != CMD_GET_STATUS:
+                self.nvm_status = NVM_STATUS_DONE
+            if byte in (CMD_WRITE_ROW, CMD_WRITE_ROW_RLE):
+                self.buffer_index = 0
+                self.row_complete = False
+                self.row_address_ok = False
+                self.rle_words_left = 0
+            self.stream_word = None
+            return 0.0
+        if self.i2c_status != "control":
+            return 0.0
+        cmd = self.control_word
+        if cmd in (CMD_SET_FLASH_ADDRESS, CMD_STREAM_READ):
+            if self.address_index == 1:
+                self.flash_address = (self.flash_address & 0xff) | (byte << 8)
+                self.address_index = 0
+            else:
+                self.flash_address = (self.flash_address & 0xff00) | byte
+                self.address_index = 1
+        elif cmd == CMD_WRITE_TO_BUFFER:
+            if self.buffer_index == 64:
+                self.buffer_index = 63
+            self.buffer_byte(byte)
+        elif cmd in (CMD_WRITE_ROW, CMD_WRITE_ROW_RLE):
+            if self.address_index == 0:
+                self.flash_address = (self.flash_address & 0xff00) | byte
+                self.address_index = 1
+            elif self.address_index == 1:
+                self.flash_address = (self.flash_address & 0xff) | (byte << 8)
+                self.address_index = 2
+            elif self.address_index == 2:
+                self.address_index = 3
+                if self.row_address_valid() and self.crc.CRC([self.flash_address & 0xff, self.flash_address >> 8]) == byte:
+                    self.row_address_ok = True
+                    return self.flash_erase(self.flash_address)
+            elif self.buffer_index < 64:
+                if cmd == CMD_WRITE_ROW_RLE:
+                    self.decode_byte(byte)
+                else:
+                    self.buffer_byte(byte)
+            else:
+                self.row_crc_received = byte
+                self.row_complete = True
+                if self.broadcast: #nobody reads a status after a broadcast
+                    status, busy = self.write_row()
+                    return busy
+        elif cmd in (CMD_READ_ROW_CRC, CMD_ERASE_RANGE):
+            if self.address_index == 0:
+                self.flash_address = (self.flash_address & 0xff00) | byte
+                self.address_index = 1
+            elif self.address_index == 1:
+                self.flash_address = (self.flash_address & 0xff) | (byte << 8)
+                self.address_index = 2
+            elif cmd == CMD_READ_ROW_CRC:
+                self.crc_rows_left = byte
+            else:
+                self.start_erase(byte)
+        elif cmd == CMD_VERIFY_APPLICATION:
+            self.row_crc_received = byte
+        elif cmd == CMD_SET_SLAVE_ADDRESS:
+            self.new_slave_address = byte
+        return 0.0
+    def start_erase(self, n_rows):
+        self.erase_rows_erased = 0
+        self.erase_rows_left = 0
+        if not self.row_address_valid():
+            self.nvm_status = NVM_STATUS_ERROR
+            return
+        self.erase_address = self.flash_address
+        rows_to_end = (APPLICATION_END - self.erase_address) >> 5
+        self.erase_rows_left = rows_to_end if n_rows == 0 or n_rows > rows_to_end else n_rows
+        self.erase_time = self.last_activity
+    def next_row_crc(self):
+        if self.crc_rows_left == 0:
+            return 0x00, 0.0
+        crc = self.row_crc(self.flash_address)
+        self.flash_address = self.flash_address + 32
+        self.crc_rows_left = self.crc_rows_left - 1
+        return crc, 32*WORD_READ_TIME
+    def next_stream_byte(self):
+        if self.stream_word is None:
+            self.stream_word = self.flash_read(self.flash_address)
+            return self.stream_word & 0xff
+        byte = self.stream_word >> 8
+        self.stream_word = None
+        self.flash_address = (self.flash_address + 1) & 0xffff
+        return byte
+    def bl_read(self, n, now):
+        self.last_activity = now
+        self.startup_window = None
+        self.i2c_status = "read" #I2C_READ_STARTED
+        data = []
+        busy = 0.0
+        for i in range(n):
+            if self.mode != "bootloader": #reset by the first byte
+                data.append(0xff)
+                continue
+            byte, t = self.bl_read_byte(i == 0, now + busy)
+            busy = busy + t
+            if byte is None: #nothing loaded into SSP2BUF, the master reads the old content
+                byte = self.last_byte
+            self.last_byte = byte
+            data.append(byte)
+        if self.mode == "bootloader" and n > 0: #the master's NACK raises SSP2IF with R_nW = 0, seen as a written byte (SSP2BUF still holds the last one)
+            busy = busy + self.bl_write_byte(self.last_byte)
+        return data, busy
+    def bl_read_byte(self, first, now):
+        cmd = self.control_word
+        if cmd == CMD_SET_FLASH_ADDRESS:
+            return (self.flash_address & 0xff if first else self.flash_address >> 8), 0.0
+        if cmd == CMD_READ_FROM_FLASH:
+            if first:
+                for i in range(32):
+                    word = self.flash_read(self.flash_address)
+                    self.buffer[2*i] = word >> 8
+                    self.buffer[2*i + 1] = word & 0xff
+                    self.flash_address = self.flash_address + 1
+                self.buffer_index = 0
+            byte = self.buffer[self.buffer_index]
+            self.buffer_index = min(self.buffer_index + 1, 63)
+            return byte, (32*WORD_READ_TIME if first else 0.0)
+        if cmd == CMD_READ_FROM_FLASH_SECOND_HALF:
+            if first:
+                self.buffer_index = 32
+            byte = self.buffer[self.buffer_index]
+            self.buffer_index = min(self.buffer_index + 1, 63)
+            return byte, 0.0
+        if cmd == CMD_READ_ROW_CRC:
+            return self.next_row_crc()
+        if cmd == CMD_VERIFY_APPLICATION:
+            if not first:
+                return self.app_crc_calculated, 0.0
+            self.app_crc_calculated = self.application_crc()
+            if all(self.flash_read(a) == BLANK_WORD for a in range(0x1000, 0x2000)):
+                return ROW_STATUS_BLANK_ERROR, 2*4096*WORD_READ_TIME
+            if self.app_crc_calculated != self.row_crc_received:
+                return ROW_STATUS_CRC_ERROR, 4096*WORD_READ_TIME
+            return ROW_STATUS_OK, 4096*WORD_READ_TIME + self.update_user_id(1, (USER_ID_MARKER << 8) | self.app_crc_calculated)
+        if cmd == CMD_ERASE_RANGE:
+            self.bl_tick(now)
+            return (self.erase_rows_left if first else self.erase_rows_erased), 0.0
+        if cmd == CMD_STREAM_READ:
+            return self.next_stream_byte(), WORD_READ_TIME
+        if not first: #no Data case in I2C_Communicate()
+            return None, 0.0
+        if cmd == CMD_ERASE_ROW_FROM_FLASH:
+            busy = self.flash_erase(self.flash_address)
+            return self.nvm_status, busy
+        if cmd == CMD_BUFFER_TO_FLASH:
+            busy = self.flash_write_row(self.buffer_address, self.buffer) if self.buffer_index > 0 else 0.0
+            crc = self.crc.CRC(self.buffer[:self.buffer_index])
+            self.flash_address = self.flash_address + 32
+            self.buffer_index = 0
+            return crc, busy
+        if cmd in (CMD_WRITE_ROW, CMD_WRITE_ROW_RLE):
+            return self.write_row()
+        if cmd == CMD_SET_SLAVE_ADDRESS:
+            busy = self.update_user_id(2, (USER_ID_MARKER << 8) | (self.new_slave_address & 0x7f))
+            return self.nvm_status, busy
+        if cmd == CMD_GET_STATUS:
+            return self.nvm_status, 0.0
+        if cmd == CMD_RUN_APPLICATION:
+            self.handoff = HANDOFF_LEAVE
+            self.boot(now)
+            return 0x00, 1e-3
+        if cmd == CMD_RESET:
+            self.boot(now)
+            return 0x00, 0.0
+        return 0x01, 0.0
+    """
+    Application (EnergySum.X/ESUM.c)
+    """
+    def app_init(self, now):
+        self.memory = [0]*256
+        self.memory[I2C_STORE] = self.app_address
+        self.memory[VERSION_REGISTER] = VERSION_NUMBER
+        self.memory[BT_DEADBAND] = 4
+        self.memory[BT_STEP] = 1
+        self.memory[BT_INTERVAL] = 10
+        self.memory[BT_LIMIT] = 0x80
+        for address, label in ((0x1c, b"MDAC"), (0x2c, b"ODAC"), (0x3c, b"ADC"), (0x4c, b"UID"), (0x6c, b"BLT")):
+            self.memory[address:address + len(label)] = list(label)
+        self.memory_address = 0
+        self.mdac = [0]*self.n_mdacs
+        self.odac = 0
+        self.leds = [1, 1, 1]
+        self.testpulser = False
+        self.busy_until = now #main loop: time when the current flag has been handled
+        self.pending = None #result of that flag, applied at busy_until
+        self.bt_running = False
+        self.bt_code = 0
+        self.bt_correction = 0
+        self.bt_next = now
+        self.uid = [0x00, 0x04, 0xA3, 0x12, 0x34, 0x56]
+    def adc_measure(self, nref = False): #baseline pin: a higher ODAC code gives a lower reading (10-bit)
+        if nref:
+            return 512
+        value = BASELINE_ADC_VALUE + (0x360 - self.odac)/4 + self.adc_offset + self.random.uniform(-1, 1)
+        return max(0, min(1023, int(value)))
+    def app_write(self, data, now):
+        if len(data) == 0:
+            return 0.0
+        self.memory_address = data[0]
+        for byte in data[1:]:
+            self.memory[self.memory_address] = byte
+            self.memory_address = (self.memory_address + 1) % 256
+        self.app_tick(now)
+        return 0.0
+    def app_read(self, n):
+        data = []
+        for i in range(n):
+            data.append(self.memory[self.memory_address])
+            self.memory_address = (self.memory_address + 1) % 256
+        return data
+    def app_tick(self, now): #main loop: flags are handled one after another; a result appears (and the flag is cleared) when its handler is done
+        if self.mode != "application":
+            return
+        while self.busy_until <= now:
+            t = self.busy_until
+            if self.pending is not None:
+                pending, self.pending = self.pending, None
+                pending()
+                if self.mode != "application": #reset
+                    return
+                continue
+            m = self.memory
+            if m[TP_FLAG] != 0: #Testpulser_Do() blocks the main loop until the flag is cleared over I2C
+                self.testpulser = True
+                self.busy_until = now
+                return
+            if self.testpulser:
+                self.testpulser = False
+                continue
+            if m[MDAC_FLAG] & 0b111:
+                self.handle(t, 1e-3, self.mdac_process)
+            elif m[ODAC_FLAG]:
+                self.handle(t, 1e-3, self.odac_process)
+            elif m[I2C_FLAG] & 0b1: #address is taken from memory[I2C_STORE], see addresses()
+                self.handle(t, 1e-4, lambda: self.clear_flag(I2C_FLAG, 0b11111110))
+            elif m[ADC_FLAG] & 0b1:
+                self.handle(t, 1.2, self.adc_process) #__delay_ms(200) + __delay_ms(1000)
+            elif m[BL_FLAG] == 0b1:
+                self.handle(t, 1.5, self.baseline_process) #12 steps of 100 ms and settling
+            elif m[UID_FLAG] == 0b1:
+                self.handle(t, 1e-3, self.uid_process)
+            elif m[LED_FLAG] != 0:
+                self.handle(t, 1e-5, self.led_process)
+            elif m[RESET_FLAG] != 0:
+                if m[RESET_FLAG] == 0x02:
+                    self.handoff = HANDOFF_STAY
+                self.boot(t)
+                return
+            elif m[BT_FLAG] & 0b1:
+                if not self.bt_running:
+                    self.bt_code = self.odac #last applied code, not the ODAC_MSB/LSB shadow
+                    self.bt_correction = 0
+                    self.bt_running = True
+                    self.bt_next = t + m[BT_INTERVAL]*10e-3
+                if self.bt_next > now:
+                    self.busy_until = self.bt_next
+                    return
+                self.tracking_step(m)
+                self.busy_until = self.bt_next
+                self.bt_next = self.bt_next + max(1, m[BT_INTERVAL])*10e-3
+            else:
+                self.bt_running = False
+                self.busy_until = now + 1e-4
+                return
+    def handle(self, t, duration, action):
+        self.busy_until = t + duration
+        self.pending = action
+    def clear_flag(self, register, mask):
+        self.memory[register] &= mask
+    def mdac_process(self): #MDAC_Process()
+        m = self.memory
+        if m[MDAC_FLAG] & 0b010:
+            self.mdac = m[0:self.n_mdacs]
+        if m[MDAC_FLAG] & 0b001:
+            channel = m[MDAC_FLAG] >> 3
+            if 1 <= channel <= self.n_mdacs:
+                self.mdac[channel - 1] = m[channel - 1]
+        if m[MDAC_FLAG] & 0b100:
+            m[0:self.n_mdacs] = self.mdac
+        m[MDAC_FLAG] &= 0b11111000
+    def odac_process(self): #ODAC_Process()
+        m = self.memory
+        if m[ODAC_FLAG] & 0b01:
+            self.odac = ((m[ODAC_MSB] << 8) | m[ODAC_MSB + 1]) & 0xfff
+            self.bt_running = False
+        if m[ODAC_FLAG] & 0b10:
+            m[ODAC_MSB], m[ODAC_MSB + 1] = self.odac >> 8, self.odac & 0xff
+        m[ODAC_FLAG] = 0
+    def adc_process(self): #ADC_Process()
+        m = self.memory
+        value = self.adc_measure(bool(m[ADC_FLAG] & 0b10))
+        m[ADC_MSB], m[ADC_MSB + 1] = value >> 8, value & 0xff
+        m[ADC_FLAG] &= 0b11111110
+    def baseline_process(self): #SetBaseline(): interval halving
+        m = self.memory
+        code = 0
+        for bit in range(11, -1, -1):
+            self.odac = code | (1 << bit)
+            if self.adc_measure() >= BASELINE_ADC_VALUE:
+                code = code | (1 << bit)
+        self.odac = code
+        m[ODAC_MSB], m[ODAC_MSB + 1] = code >> 8, code & 0xff
+        self.bt_running = False
+        m[BL_FLAG] &= 0b11111110
+    def uid_process(self):
+        self.memory[UID_FLAG] = 0
+        self.memory[UID_STORE:UID_STORE + 6] = self.uid
+    def led_process(self):
+        m = self.memory
+        for i in range(3):
+            if m[LED_FLAG] == i + 1 or m[LED_FLAG] > 3:
+                self.leds[i] ^= 1
+        m[LED_FLAG] = 0
+    def tracking_step(self, m): #Tracking_Process()
+        baseline = sum(self.adc_measure() for i in range(8)) >> 3
+        m[BT_AVG_MSB], m[BT_AVG_MSB + 1] = baseline >> 8, baseline & 0xff
+        step = 0
+        if baseline > BASELINE_ADC_VALUE + m[BT_DEADBAND]:
+            step = min(m[BT_STEP], 0xfff - self.bt_code)
+        elif baseline + m[BT_DEADBAND] < BASELINE_ADC_VALUE:
+            step = -min(m[BT_STEP], self.bt_code)
+        if m[BT_LIMIT] != 0:
+            step = max(-m[BT_LIMIT] - self.bt_correction, min(m[BT_LIMIT] - self.bt_correction, step))
+        if step != 0:
+            self.bt_code = self.bt_code + step
+            self.bt_correction = self.bt_correction + step
+            self.odac = self.bt_code
+        m[BT_CORR_MSB], m[BT_CORR_MSB + 1] = (self.bt_correction >> 8) & 0xff, self.bt_correction & 0xff
+        m[BT_CODE_MSB], m[BT_CODE_MSB + 1] = self.bt_code >> 8, self.bt_code & 0xff
+
+class SimUID: #24AA025E48 UID EEPROM of the board: register pointer, then sequential read
+    def __init__(self, uid = (0x00, 0x04, 0xA3, 0x12, 0x34, 0x56)):
+        self.memory = [0xff]*256
+        self.memory[UID_REGISTER:UID_REGISTER + 6] = list(uid)
+        self.pointer = 0
+    def addresses(self):
+        return [UID_ADDRESS]
+    def tick(self, now):
+        pass
+    def write(self, address, data, now):
+        if len(data) > 0:
+            self.pointer = data[0]
+        return 0.0
+    def read(self, address, n, now):
+        data = [self.memory[(self.pointer + i) % 256] for i in range(n)]
+        self.pointer = (self.pointer + n) % 256
+        return data, 0.0
+    def stop(self, now):
+        pass
+
+class SimBus:
+    """
+    I2C bus with simulated devices. transfer() has the interface of i2cdev.I2CBus; a write without answering device is a NACK (IOError).
+    realtime: every transfer takes as long as it would on the bus, and time between transfers counts for the devices.
+    bit_error_rate: probability of each bit on the wire being flipped (fault injection); a damaged address byte is a NACK.
+    """
+    def __init__(self, devices = None, realtime = False, bit_error_rate = 0.0, seed = None):
+        self.devices = devices if devices is not None else [SimModule()]
+        self.realtime = realtime
+        self.bit_error_rate = bit_error_rate
+        self.random = random.Random(seed)
+        self.bit_errors = 0
+        self.now = 0.0 #virtual clock, seconds
+        self.start = time.monotonic()
+        self.bytes = 0 #on the wire, including address bytes
+        self.transfers = 0
+    def find(self, address):
+        if address == GENERAL_CALL_ADDRESS:
+            return [d for d in self.devices if GENERAL_CALL_ADDRESS in d.addresses()]
+        return [d for d in self.devices if address in d.addresses()]
+    def corrupt(self, data): #flips each bit with probability bit_error_rate
+        if self.bit_error_rate <= 0:
+            return list(data)
+        noisy = []
+        for byte in data:
+            for i in range(8):
+                if self.random.random() < self.bit_error_rate:
+                    byte ^= 1 << i
+                    self.bit_errors = self.bit_errors + 1
+            noisy.append(byte)
+        return noisy
+    def advance(self, dt):
+        self.now = self.now + dt
+        if self.realtime:
+            delay = self.start + self.now - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+    def transfer(self, address, write_bytes, read_length):
+        if self.realtime: #idle time between transfers passes for the devices too
+            self.now = max(self.now, time.monotonic() - self.start)
+        for device in self.devices:
+            device.tick(self.now)
+        self.transfers = self.transfers + 1
+        devices = self.find(address)
+        if self.corrupt([address << 1])[0] != address << 1:
+            devices = []
+        if len(devices) == 0 or (read_length > 0 and address == GENERAL_CALL_ADDRESS):
+            self.advance(BYTE_TIME)
+            self.bytes = self.bytes + 1
+            raise IOError(f"No ACK from {hex(address)}.")
+        busy = 0.0
+        data = []
+        if len(write_bytes) > 0:
+            write_bytes = self.corrupt(write_bytes) #all modules see the same damaged bytes
+            busy = max(device.write(address, write_bytes, self.now) for device in devices) #the slowest module stretches the clock for all
+            self.bytes = self.bytes + 1 + len(write_bytes)
+        if read_length > 0:
+            data, read_busy = devices[0].read(address, read_length, self.now + busy)
+            data = self.corrupt(data)
+            busy = busy + read_busy
+            self.bytes = self.bytes + 1 + read_length
+        self.advance((1 + len(write_bytes) + (1 + read_length if read_length > 0 else 0))*BYTE_TIME + busy)
+        for device in devices:
+            device.stop(self.now)
+        return data
+    def close(self):
+        pass
+
+class BridgeServer:
+    """
+    Serves a SimBus on a pseudo-terminal, speaking the protocol of the Arduino bridge (ASCII I2CW/I2CR lines).
+    """
+    def __init__(self, bus: SimBus):
+        self.bus = bus
+        self.master, slave = os.openpty()
+        tty.setraw(slave)
+        self.slave = slave
+        self.port = os.ttyname(slave)
+        self.input = b""
+    def answer(self, data):
+        os.write(self.master, data)
+    def handle_ascii(self):
+        while b"\r" in self.input:
+            line, self.input = self.input.split(b"\r", 1)
+            words = line.decode(errors = "replace").split()
+            if len(words) < 3:
+                continue
+            n = int(words[1])
+            address = int(words[2], 16)
+            try:
+                if words[0] == "I2CW":
+                    self.bus.transfer(address, [int(word, 16) for word in words[3:3 + n]], 0)
+                elif words[0] == "I2CR":
+                    data = self.bus.transfer(address, [], n)
+                    self.answer(b"".join(f"{byte:X}\r\n".encode() for byte in data))
+            except IOError:
+                if words[0] == "I2CR": #open bus reads 0xFF
+                    self.answer(b"FF\r\n"*n)
+    def serve(self):
+        while True:
+            readable, _, _ = select.select([self.master], [], [], 1.0)
+            if self.master in readable:
+                self.input = self.input + os.read(self.master, 4096)
+                self.handle_ascii()
+
+if __name__ == "__main__":
+    n_modules = int(sys.argv[sys.argv.index("--modules") + 1]) if "--modules" in sys.argv else 1
+    modules = [SimModule(seed = i) for i in range(n_modules)]
+    for i, module in enumerate(modules[1:]): #individual bootloader addresses, as set with Arduino.set_bootloader_address()
+        module.user_id[2] = (USER_ID_MARKER << 8) | (0x10 + i + 1)
+    modules[0].user_id[2] = (USER_ID_MARKER << 8) | 0x10 if n_modules > 1 else BLANK_WORD
+    bus = SimBus(modules + [SimUID()], realtime = "--fast" not in sys.argv)
+    server = BridgeServer(bus)
+    print(f"Simulated bridge on {server.port} ({n_modules} module(s)). Ctrl+C to stop.")
+    try:
+        server.serve()
+    except KeyboardInterrupt:
+        pass
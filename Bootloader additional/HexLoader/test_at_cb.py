@@ -6,8 +6,8 @@ I2C_ADDRESS = 0x1e
 TESTPULSER_FLAG = 0x50
 MDAC_FLAG = 0x18
 class Test:
-    def __init__(self):
-        self.a = Arduino(I2C_ADDRESS) #I2C with firmware
+    def __init__(self, a = None): #a: any transport with the Arduino interface (e.g. i2cdev.I2CDev), default is the Arduino bridge
+        self.a = a if a is not None else Arduino(I2C_ADDRESS) #I2C with firmware
     def switchToESUM(self):
         self.a.change_address(0x1f)
         #self.a.close() #free up COM port
@@ -63,6 +63,46 @@ class Test:
         self.a.change_address(I2C_ADDRESS)
     def setBL(self):
         self.a.send_bytes_list([0x51, 0x01]) #Baseline flag is 0x51, set bit 0 to 1 to initiate BL-setting; is cleared automatically.
+    def trackBL(self, on = True, deadband = 4, step = 1, interval = 10, limit = 0x80): #continuous baseline tracking, interval in 10 ms units
+        self.a.send_bytes_list([0x61, deadband, step, interval, limit])
+        self.a.send_bytes_list([0x60, 0x01 if on else 0x00])
+    def readBLCorrection(self): #current tracking correction (signed, ODAC codes), averaged baseline reading, then tracked ODAC code
+        self.a.read_n_bytes(0x65, 6)
+    def readCounters(self): #counters window 0x70-0x96 in one burst, see CNT_flag in main.h
+        c = self.a.write_read([0x70], 0x27)
+        word = lambda i: (c[i - 0x70] << 8) | c[i + 1 - 0x70]
+        counters = {name: word(i) for name, i in (("isr", 0x71), ("rx", 0x73), ("tx", 0x75), ("loops", 0x77), ("wcol", 0x79),
+            ("spi", 0x80), ("i2c", 0x82), ("adc", 0x84), ("bt", 0x86), ("tp", 0x88), ("misc", 0x8a))}
+        counters["pcon"] = c[0x90 - 0x70]
+        counters["resets"] = dict(zip(("por", "bor", "mclr", "wdt", "reset", "stack"), c[0x91 - 0x70:0x97 - 0x70]))
+        print(counters)
+        return counters
+    def clearCounters(self):
+        self.a.send_bytes_list([0x70, 0x01])
+    def readProfile(self): #handler profiler table 0xc0-0xfe (firmware built with profiler_enabled 1): last, min, max in us
+        t = self.a.write_read([0xc0], 63)
+        us = lambda i: ((t[i] << 16) | (t[i + 1] << 8) | t[i + 2]) / 8
+        profile = {name: (us(9*row), us(9*row + 3), us(9*row + 6)) for row, name in enumerate(("isr", "spi", "i2c", "adc", "bt", "tp", "misc"))}
+        print(profile)
+        return profile
+    def clearProfile(self):
+        self.a.send_bytes_list([0xb0, 0x01])
+    def readTrace(self): #trace ring buffer streamed from 0xa2, oldest first: (register, value, done, time in ~1 ms), see TRC_flag in main.h
+        t = self.a.write_read([0xa2], 128)
+        trace = [(t[i], t[i + 1], t[i + 2] >> 7, ((t[i + 2] & 0x7f) << 8) | t[i + 3]) for i in range(0, 128, 4) if t[i:i + 4] != [0xff]*4]
+        for entry in trace:
+            print("%5d %s 0x%02x 0x%02x" % (entry[3], "done " if entry[2] else "write", entry[0], entry[1]))
+        return trace
+    def clearTrace(self):
+        self.a.send_bytes_list([0xa0, 0x01])
+    def setGroup(self, group_address = None, general_call = True): #GRP_flag/GRP_address, applied by reinitializing I2C (I2C_flag)
+        flags = (0x01 if general_call else 0x00) | (0x02 if group_address is not None else 0x00)
+        self.a.send_bytes_list([0x98, flags, group_address or 0])
+        self.a.send_bytes_list([0x53, 0x01])
+    def applyGroup(self, mdacs = True, odac = True, address = 0x00): #GRP_apply to all modules at once (general call by default)
+        self.a.change_address(address)
+        self.a.send_bytes_list([0x9a, (0x01 if mdacs else 0x00) | (0x02 if odac else 0x00)])
+        self.a.change_address(I2C_ADDRESS)
 """
 t = Test()
 t.testChannel()
@@ -42,6 +42,9 @@ unsigned char flash_address_index; //used to remember which byte needs to be wri
 unsigned char flash_buffer[64];
 unsigned char flash_buffer_index;
 unsigned char reset_timer; //initialize to 0; once it is 1, the timer is reset
+unsigned char application_corrupt; //1 if the stored application CRC does not match; the bootloader then does not time out into the application
+__persistent volatile unsigned int bootloader_handoff __at(bootloader_handoff_address); //request that survives RESET (not cleared at startup); random after power-up or brown-out, so only read after other resets
+__persistent volatile unsigned char reset_counters[reset_causes] __at(reset_counters_address); //not cleared at startup; the application counts its resets there, power-on and brown-out (random RAM: counters start from 0) are counted here
 
 //the interrupt flag is at 0x004 in the PIC, i.e. bootloader space; half the memory is protected. This function forwards the flag to the unprotected 0x1004 (the firmware should have offset 0x1000).
 void  __interrupt() service_isr(){
@@ -57,13 +60,45 @@ void  __interrupt() service_isr(){
 void main(void) {
     __delay_ms(100); //wait for voltages to stabilize
     Initialize();
-    I2C_SlaveInit(I2C_SLAVE_ADDRESS);
-    if(flash_memory_read(bootloader_flag_address, 1) == 1){//bootloader flag: 1 to leave bootloader, 0 to stay.
+    I2C_SlaveInit(flash_memory_get_bootloader_address(I2C_SLAVE_ADDRESS)); //individual address if one has been set (COMMAND_SET_SLAVE_ADDRESS), also listens to general call
+    unsigned int handoff = bootloader_handoff;
+    bootloader_handoff = 0; //a request only holds for one reset
+    if(PCON0bits.nPOR == 0 || PCON0bits.nBOR == 0){//RAM is random: ignore the handoff, use flag and CRC in flash
+        handoff = 0;
+        for(unsigned char i = 0; i < reset_causes; i++){//same bookkeeping as Counters_Init() of the application, which will not see these bits any more
+            reset_counters[i] = 0;
+        }
+        reset_counters[PCON0bits.nPOR == 0 ? 0 : 1] = 1; //power-on or brown-out
+        PCON0bits.nPOR = 1; //re-armed, so that the next RESET (e.g. COMMAND_START_FIRMWARE) passes its handoff
+        PCON0bits.nBOR = 1;
+    }
+    if(handoff == bootloader_handoff_leave){
         LeaveBootloader();
     }
+    unsigned int flag = bootloader_flag_stay;
+    if(handoff != bootloader_handoff_stay){//no request in RAM (cold boot): fall back to the flag in flash
+        flag = flash_memory_read(bootloader_flag_address, 1);
+    }
+    if(flag == bootloader_flag_leave){
+        LeaveBootloader();
+    }
+    if(flag != bootloader_flag_stay){//no explicit request to stay: start application at once if it is intact
+        unsigned int crc_word = flash_memory_read(application_crc_address, 1);
+        if((crc_word >> 8) == user_id_marker){//no CRC stored (uploaded without verification): wait for timeout as before
+            if((crc_word & 0xff) == I2C_CalculateApplicationCRC()){
+                if(!StartupWindow()){//a master talking to the bootloader right after RESET can still recover a broken application
+                    LeaveBootloader();
+                }
+            }
+            else{
+                application_corrupt = 1;
+            }
+        }
+    }
     reset_timer = 1; //for some reason, if timer is not reset in beginning, TMR0IF gets set instantly, leading to a waiting time for i2c of 0.
     while(1){
         I2C_Communicate();
+        I2C_EraseStep(); //COMMAND_ERASE_RANGE, one row at a time
         if(reset_timer){
             TMR0H = 0;
             TMR0L = 0;
@@ -71,7 +106,9 @@ void main(void) {
         }
         if(TMR0IF){//Waiting time is up; IMPORTANT: if no firmware is present, a restart is still needed to get back to bootloader again.
             TMR0IF = 0;
-            LeaveBootloader(); 
+            if(!application_corrupt){
+                LeaveBootloader(); 
+            }
         }
         asm("CLRWDT"); //clear watchdog timer
     }
@@ -130,13 +167,29 @@ void Initialize(void){
     WDTCONbits.SWDTEN = 1; //start watchdog timer
 }
 
+/*
+ * Serves I2C for startup_window_ms; returns 1 as soon as a transaction has started (the main loop then continues it).
+ */
+unsigned char StartupWindow(void){
+    reset_timer = 0;
+    for(unsigned int i = 0; i < 10*startup_window_ms; i++){
+        I2C_Communicate(); //SCL is held low by clock stretching between the polls
+        if(reset_timer){
+            return 1;
+        }
+        __delay_us(100);
+        asm("CLRWDT");
+    }
+    return 0;
+}
+
 void LeaveBootloader(void){
     asm("CLRWDT"); //clear watchdog timer to avoid being interrupted by its reset
     T0CON0bits.T0EN = 0; //Disable timer
     OSCENbits.LFOEN = 0; //Turn off oscillator
     TMR0IF = 0;
     //datasheet 317: to reconfigure SPI (or, in this case, the SSP module), need to clear SSPEN bit.
-    flash_memory_set_bootloader_flag(0); //on restart, stay in bootloader
+    flash_memory_set_bootloader_flag(bootloader_flag_none); //clears a flag left in flash (e.g. by an older application); nothing is written if there is none
     SSP2IF = 0;
     PCLATH = 0b0010000; //56/491 Figure 4-3.; want to jump to 0x100_.
     asm("GOTO 0x0000;"); //see 403/491 on description of GOTO
@@ -54,6 +54,34 @@ void flash_memory_write (unsigned int address, unsigned char *data, unsigned cha
     nvm_unlock(); //unlock sequence, this time also initiates write to flash
     NVMCON1bits.WREN = 0; //inhibit writing
 }
+
+/*
+ * Same steps as flash_memory_write(), split up so that latches can be loaded while the data of a row is still arriving.
+ * flash_memory_load_latch() loads one latch without writing (LWLO = 1), flash_memory_commit() loads the last latch
+ * of the row and starts the write of all loaded latches. The row must have been erased before the commit.
+ */
+void flash_memory_load_latch (unsigned int address, unsigned char LSbyte, unsigned char MSbyte){
+    NVMCON1bits.WREN = 1; //allow writing
+    NVMCON1bits.NVMREGS = 0;
+    NVMCON1bits.LWLO = 1; //only load the latch
+    NVMADRL = ((address)&0xff); //set address (NVMADR may have been changed by reads since the last latch)
+    NVMADRH = ((address)>>8);
+    NVMDATL = LSbyte;
+    NVMDATH = MSbyte;
+    nvm_unlock();
+}
+
+void flash_memory_commit (unsigned int address, unsigned char LSbyte, unsigned char MSbyte){
+    NVMCON1bits.WREN = 1; //allow writing
+    NVMCON1bits.NVMREGS = 0;
+    NVMCON1bits.LWLO = 0; //next write to latch will initiate write process to flash
+    NVMADRL = ((address)&0xff); //set address
+    NVMADRH = ((address)>>8);
+    NVMDATL = LSbyte;
+    NVMDATH = MSbyte;
+    nvm_unlock(); //unlock sequence, this time also initiates write to flash
+    NVMCON1bits.WREN = 0; //inhibit writing
+}
   
 /*
  * 127/491
@@ -69,21 +97,115 @@ void flash_memory_erase(unsigned int address, unsigned char erase_user_id){//era
 }	
 
 /*
- * 0x8000 (first User ID) contains the BL flag byte.
- * Useful overall for writing to program memory: http://ww1.microchip.com/downloads/en/DeviceDoc/40001738D.pdf
+ * Returns 1 if the last erase or write failed (WRERR, e.g. protected address or interrupted by a reset), 0 otherwise, and clears WRERR.
+ * 138/491
+ */
+unsigned char flash_memory_error(void){
+    if(NVMCON1bits.WRERR){
+        NVMCON1bits.WRERR = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Returns 1 if all 32 words of the row starting at address are erased (0x3FFF), 0 otherwise.
  */
-void flash_memory_set_bootloader_flag(unsigned char value){
+unsigned char flash_memory_blank (unsigned int address){
+    for(unsigned char i = 0; i < 32; i++){
+        if(flash_memory_read(address, 0) != 0x3FFF){
+            return 0;
+        }
+        address++;
+    }
+    return 1;
+}
+
+/*
+ * Compares flash memory starting at address with data (little-endian, same layout as for flash_memory_write()).
+ * Only the lower 14 bits of each word exist, so the upper two bits of the MSByte are ignored.
+ * Returns 1 if they match, 0 otherwise.
+ */
+unsigned char flash_memory_verify (unsigned int address, unsigned char *data, unsigned char n_of_bytes){
+    unsigned int word;
+    for(unsigned char i = 0; i < n_of_bytes; i+=2){
+        word = flash_memory_read(address, 0);
+        if((word & 0xff) != data[i] || (word >> 8) != (data[i+1] & 0x3f)){
+            return 0;
+        }
+        address++;
+    }
+    return 1;
+}
+
+/*
+ * Sets User ID word 0x8000 + index to value. The whole User ID row has to be erased for this,
+ * so the other words used by the bootloader are read first and written back.
+ * Nothing is written if the word already has the value.
+ */
+void flash_memory_update_user_id(unsigned char index, unsigned int value){
+    unsigned int words[user_id_words];
+    for(unsigned char i = 0; i < user_id_words; i++){
+        words[i] = flash_memory_read(bootloader_flag_address + i, 1);
+    }
+    if(words[index] == value){//spare the flash
+        return;
+    }
+    words[index] = value;
     flash_memory_erase(bootloader_flag_address, 1); //pass 1 to access user ID register
     
     NVMCON1bits.WREN = 1; //allow writing
     NVMCON1bits.NVMREGS = 1; //access user ID
-    NVMCON1bits.LWLO = 0; //next write to latch will initiate write process to flash
+    NVMCON1bits.LWLO = 1; //only load latches
     NVMADRL = bootloader_flag_LSB; //set address
     NVMADRH = bootloader_flag_MSB;
-    NVMDATL = value; //write 1 to bootloader flag word to leave bootloader on reset
-    NVMDATH = 0;
-    nvm_unlock(); //unlock sequence, this time also initiates write to flash
+    for(unsigned char i = 0; i < user_id_words; i++){
+        if(i == user_id_words - 1){
+            NVMCON1bits.LWLO = 0; //next write to latch will initiate write process to flash
+        }
+        NVMDATL = words[i] & 0xff;
+        NVMDATH = words[i] >> 8;
+        nvm_unlock();
+        NVMADR++;
+    }
     NVMCON1bits.WREN = 0; //inhibit writing
 }
 
+/*
+ * 0x8000 (first User ID) contains the BL flag word (bootloader_flag_leave, _stay or _none).
+ * Useful overall for writing to program memory: http://ww1.microchip.com/downloads/en/DeviceDoc/40001738D.pdf
+ */
+void flash_memory_set_bootloader_flag(unsigned int value){
+    flash_memory_update_user_id(0, value);
+}
 
+/*
+ * Stores crc as valid application CRC in 0x8001.
+ */
+void flash_memory_set_application_crc(unsigned char crc){
+    unsigned int crc_word = user_id_marker;
+    crc_word <<= 8;
+    crc_word |= crc;
+    flash_memory_update_user_id(1, crc_word);
+}
+
+/*
+ * Stores the individual 7-bit I2C address of the bootloader in 0x8002. Used after the next reset.
+ */
+void flash_memory_set_bootloader_address(unsigned char address){
+    unsigned int address_word = user_id_marker;
+    address_word <<= 8;
+    address_word |= (address & 0x7f);
+    flash_memory_update_user_id(2, address_word);
+}
+
+/*
+ * Returns the bootloader I2C address stored in 0x8002, or default_address if none has been stored.
+ */
+unsigned char flash_memory_get_bootloader_address(unsigned char default_address){
+    unsigned int address_word = flash_memory_read(bootloader_address_address, 1);
+    if((address_word >> 8) != user_id_marker){
+        return default_address;
+    }
+    return address_word & 0x7f;
+}
@@ -5,9 +5,30 @@
 #define bootloader_flag_address 0x8000 //first User ID word is reserved for bootloader
 #define bootloader_flag_MSB 0x80
 #define bootloader_flag_LSB 0x00
+#define bootloader_flag_leave 0x0001 //leave bootloader right away (set by COMMAND_START_FIRMWARE)
+#define bootloader_flag_stay 0x0000 //stay in bootloader (requested by the application)
+#define bootloader_flag_none 0x3FFF //erased: start application if its CRC is valid
+#define application_crc_address 0x8001 //second User ID word: CRC of 0x1000-0x1FFF in low byte, user_id_marker in high byte
+#define bootloader_address_address 0x8002 //third User ID word: individual I2C address of the bootloader in low byte, user_id_marker in high byte
+#define user_id_marker 0x2A //marks a User ID word as programmed (an erased word reads 0x3FFF)
+#define user_id_words 3 //number of User ID words used by the bootloader, starting at 0x8000
+#define bootloader_handoff_address 0x20 //bank 0 RAM word kept across RESET; same definitions in EnergySum.X/common.h
+#define bootloader_handoff_stay 0x5AA5 //stay in bootloader after RESET (requested by the application)
+#define bootloader_handoff_leave 0xA55A //start the application right away after RESET (COMMAND_START_FIRMWARE)
+#define reset_counters_address 0x22 //bank 0 RAM bytes kept across RESET for the reset counters of the application; same definitions in EnergySum.X/common.h
+#define reset_causes 6
 
 void nvm_unlock(void);
 unsigned int flash_memory_read(unsigned int address, unsigned char read_config_registers);
 void flash_memory_write (unsigned int address, unsigned char *data, unsigned char n_of_bytes );
+void flash_memory_load_latch (unsigned int address, unsigned char LSbyte, unsigned char MSbyte);
+void flash_memory_commit (unsigned int address, unsigned char LSbyte, unsigned char MSbyte);
 void flash_memory_erase (unsigned int address, unsigned char erase_config_registers);
-void flash_memory_set_bootloader_flag(unsigned char value);
\ No newline at end of file
+unsigned char flash_memory_error(void);
+unsigned char flash_memory_blank (unsigned int address);
+unsigned char flash_memory_verify (unsigned int address, unsigned char *data, unsigned char n_of_bytes);
+void flash_memory_update_user_id(unsigned char index, unsigned int value);
+void flash_memory_set_bootloader_flag(unsigned int value);
+void flash_memory_set_application_crc(unsigned char crc);
+void flash_memory_set_bootloader_address(unsigned char address);
+unsigned char flash_memory_get_bootloader_address(unsigned char default_address);
\ No newline at end of file
@@ -11,6 +11,26 @@ extern unsigned char flash_buffer[64];  //32 words in one row = 64 bytes
 extern const unsigned char lookup_table[256];
 extern unsigned char flash_buffer_index; //global index of flash_buffer
 extern unsigned char reset_timer;
+extern __persistent volatile unsigned int bootloader_handoff;
+unsigned char row_crc; //CRC received with COMMAND_WRITE_ROW
+unsigned char buffer_crc; //running CRC remainder of flash_buffer[0 ... flash_buffer_index-1]
+unsigned char row_complete; //1 if all bytes of COMMAND_WRITE_ROW have arrived
+unsigned char row_address_ok; //1 if the address check byte of COMMAND_WRITE_ROW matched and the row has been erased
+unsigned char crc_rows_left; //number of rows COMMAND_READ_ROW_CRC still reports
+unsigned char application_crc; //CRC of the application region calculated by COMMAND_VERIFY_APPLICATION
+unsigned char i2c_broadcast; //1 if the current write was sent to GENERAL_CALL_ADDRESS
+unsigned char row_pending; //1 if a broadcast row has been received and needs to be written
+unsigned char new_slave_address; //received with COMMAND_SET_SLAVE_ADDRESS
+unsigned char nvm_status; //NVM_STATUS_... of the erase/write operations since the last command byte, see COMMAND_GET_STATUS
+unsigned int erase_address; //next row to be erased by COMMAND_ERASE_RANGE
+unsigned char erase_rows_left; //rows COMMAND_ERASE_RANGE still has to check/erase
+unsigned char erase_rows_erased; //rows COMMAND_ERASE_RANGE actually had to erase (not blank)
+unsigned char rle_type; //RLE_... type of the current COMMAND_WRITE_ROW_RLE token
+unsigned char rle_words_left; //words the current token still has to deliver, 0: next byte is a token
+unsigned char rle_byte_index; //0: next data byte is an LSByte, 1: MSByte
+unsigned char rle_LSB; //LSByte of the word of an RLE_REPEAT token
+unsigned int stream_word; //word of COMMAND_STREAM_READ whose MSByte is sent next
+unsigned char stream_byte_index; //0: next byte of COMMAND_STREAM_READ is the LSByte of the word at flash_address, 1: MSByte of stream_word
 
 //TODO: Bootloader with i2c-address 0x2f does not work, CRC mismatch happens. Probably the lookup table needs to be rewritten for this feature (0x1f and 0x2f i2c addresses for the various stage modules) to work.
 
@@ -29,6 +49,8 @@ extern unsigned char reset_timer;
  * SDA pin: RC6 (pin 8)
  * 
  * NO interrupts are utilized, only the SSP2IF can be used in if() statements!
+ * The general call address is also recognized (broadcast rows), and SCL is stretched after each received byte
+ * until I2C_Communicate() has handled it, so a broadcast never overruns a module that is still writing flash.
  */
 void I2C_SlaveInit(unsigned char slave_address){    //slave_address of the form: x S6 S5 ... S0!
     //PIE2bits.SSP2IE = 1;            //Enable SSP2 interrupt (not needed actually, this setting is not responsible for the interrupt flag)       
@@ -72,7 +94,7 @@ void I2C_SlaveInit(unsigned char slave_address){    //slave_address of the form:
     SSP2CON1 = 0b00110110; //THIS CAUSES BUGS WHEN TWO INITIALIZATIONS HAPPEN AFTER ANOTHER!!
     
     //p. 362
-    SSP2CON2 = 0b0; //same as default settings
+    SSP2CON2 = 0b10000001; //GCEN: general call enabled, SEN: clock stretching enabled
     SSP2CON3 = 0b0;
     //p. 363, also 325 30.4.4 SDA hold time
     SSP2IF = 0; //TODO: if I2C has problems, this might be the reason!
@@ -114,11 +136,33 @@ void I2C_SendBack(unsigned char data){//slave sends master a byte
  * 1a. Set flash memory address: slave address W, write 0x01, write LSB, write MSB.
  * 1b. Get flash memory address: slave address W, write 0x01, stop, slave address R, read 2 bytes. Returns MSB, then LSB.
  * 2. Write to flash buffer (16 bytes): slave address W, write 0x02, write 16 bytes, stop.
+ *    Write latches are loaded as the words arrive, so flash memory address has to be set (and the row erased) before.
  * 3. Read from flash memory: (set flash memory address to set first value to read back) slave address W, write 0x03, stop, slave address R, read 16 bytes.
- * 4. Erase row from flash memory: (set flash memory address to an initial index of a row!) slave address W, write 0x04, stop, slave address R, read 1 byte (0x00).
- * 5. Write from buffer to flash memory: (set flash memory address to initial index to write to!) slave address W, write 0x05, stop, slave address R, read 1 byte (0x00).
+ * 4. Erase row from flash memory: (set flash memory address to an initial index of a row!) slave address W, write 0x04, stop, slave address R, read 1 byte (NVM_STATUS_...).
+ * 5. Write from buffer to flash memory: (set flash memory address to initial index to write to!) slave address W, write 0x05, stop, slave address R, read 1 byte (CRC of buffer).
  * 6. Restart PIC and start program: slave address W, write 0x06, stop, slave address R, read 1 byte (0x00).
  * 7. Write buffer to config bits: slave address W, write 0x07, stop, slave address R, read 1 byte.
+ * 9. Write whole row: slave address W, write 0x09, write address LSB, MSB, 64 data bytes, CRC, stop, slave address R, read 1 byte (ROW_STATUS_...).
+ *    The row is erased as soon as the address has arrived, latches are loaded as the words arrive (see I2C_BufferByte()).
+ *    The clock is stretched while the row is written and read back.
+ * 10. Read row CRCs: slave address W, write 0x0A, write address LSB, MSB, number of rows n, stop, slave address R, read n bytes.
+ *    Byte i is the CRC of the row at address + 32*i, calculated over the words in the order of COMMAND_WRITE_TO_BUFFER (LSByte first).
+ * 11. Verify application: slave address W, write 0x0B, write expected CRC of 0x1000-0x1FFF (same byte order), stop, slave address R, read 2 bytes (status, calculated CRC).
+ *    If the CRC matches, it is stored in User ID 0x8001 and the application is started right away on every boot.
+ * 12. Set slave address: slave address W, write 0x0C, write new 7-bit address, stop, slave address R, read 1 byte (NVM_STATUS_...). Used after the next reset.
+ * 13. Get status: slave address W, write 0x0D, stop, slave address R, read 1 byte (NVM_STATUS_...).
+ * 14. Erase range: slave address W, write 0x0E, write first row LSB, MSB, number of rows (0: up to the end of the application region), stop.
+ *    The rows are erased one per main loop iteration (blank rows are skipped), so the bus stays responsive. Progress: slave address R, read 2 bytes
+ *    (rows left, rows erased so far), repeat until rows left is 0. Errors are reported by COMMAND_GET_STATUS afterwards (do not send other commands before).
+ * 15. Write compressed row: as 9., with command 0x0F and the 64 data bytes replaced by tokens (see I2C_DecodeByte()). The CRC is the one of the decoded row.
+ *    A token byte is the RLE_... type ORed with (number of words - 1); tokens follow each other until 32 words have been decoded, then the CRC byte.
+ * 16. Stream read: slave address W, write 0x10, write start address LSB, MSB, stop, slave address R, read any number of bytes (LSByte first, as written).
+ *    Each word is read from flash when its LSByte is clocked out and the address moves on after its MSByte, across row boundaries.
+ *    Further reads (without a new command) continue where the last one stopped, so the 32-byte limit of the bridge does not require new addresses.
+ * Busy/ready: the CPU stalls during erase and write, and SCL is held low until the answer (or, for writes, the next byte) has been handled.
+ *    Every answer above is therefore only sent once the NVM operation is finished; the host does not need to wait.
+ * Broadcast: general call address W, write 0x09 (or 0x0F), address LSB, MSB, 64 data bytes (or tokens), CRC, stop. Every bootloader writes the row right after the CRC byte;
+ *    the result is checked per module with COMMAND_READ_ROW_CRC.
  */
 
 
@@ -148,9 +192,22 @@ void I2C_Communicate(void){
                                flash_buffer_index--;
                    }
                            break;
+                       case COMMAND_READ_ROW_CRC:
+                           I2C_SendBack(I2C_NextRowCRC());
+                           break;
+                       case COMMAND_VERIFY_APPLICATION:
+                           I2C_SendBack(application_crc);
+                           break;
+                       case COMMAND_ERASE_RANGE:
+                           I2C_SendBack(erase_rows_erased);
+                           break;
+                       case COMMAND_STREAM_READ:
+                           I2C_SendBack(I2C_NextStreamByte());
+                           break;
                }
                }
                else{//Address
+                   i2c_status = I2C_READ_STARTED; //the master's NACK after the last byte raises SSP2IF with R_nW = 0 (no stop interrupt, PCIE = 0); it must not be taken as a parameter byte
                    switch(i2c_control_word){
                        case COMMAND_SET_FLASH_ADDRESS://in Read mode, this means reading back flash memory current address
                            I2C_SendBack(flash_address.bytes.LSbyte); //send LSB; MSB will be sent back in Data mode
@@ -172,21 +229,47 @@ void I2C_Communicate(void){
                            I2C_SendBack(flash_buffer[flash_buffer_index]);
                            flash_buffer_index++;
                            break;
-                       case COMMAND_ERASE_FLASH_ROW:
-                           I2C_SendBack(0x00);
+                       case COMMAND_ERASE_FLASH_ROW: //erase first, the answer is sent once it is done
                            flash_memory_erase(flash_address.word.address, 0); //pass 0 to access program flash memory instead of user ID etc.
+                           I2C_UpdateNVMStatus();
+                           I2C_SendBack(nvm_status);
                            //flash_address.word.address += 32; //whole row has been erased
                            break;
                        case COMMAND_WRITE_TO_FLASH: //write from buffer to memory with initial word marked by flash_address.word.address
                            //I2C_SendBack(0x00);
-                           I2C_SendBack(I2C_CalculateCRC());
-                           flash_memory_write(flash_address.word.address, flash_buffer, 64);
+                           flash_memory_commit(flash_address.word.address + 31, flash_buffer[62], flash_buffer[63]); //words 0-30 are already in the latches
+                           I2C_UpdateNVMStatus();
+                           I2C_SendBack(buffer_crc ^ CRC_FINAL_XOR_VALUE); //same as I2C_CalculateCRC(), but updated as the bytes arrived
                            flash_address.word.address += 32;
                            flash_buffer_index = 0; //ready to fill buffer again.
                            break;
+                       case COMMAND_WRITE_ROW: //erase, write, verify; SCL is held low until the status is ready
+                       case COMMAND_WRITE_ROW_RLE:
+                           I2C_SendBack(I2C_WriteRow());
+                           break;
+                       case COMMAND_READ_ROW_CRC: //each CRC is calculated while SCL is held low
+                           I2C_SendBack(I2C_NextRowCRC());
+                           break;
+                       case COMMAND_VERIFY_APPLICATION: //SCL is held low during the calculation (~20 ms)
+                           I2C_SendBack(I2C_VerifyApplication());
+                           break;
+                       case COMMAND_SET_SLAVE_ADDRESS:
+                           flash_memory_set_bootloader_address(new_slave_address);
+                           I2C_UpdateNVMStatus();
+                           I2C_SendBack(nvm_status);
+                           break;
+                       case COMMAND_GET_STATUS:
+                           I2C_SendBack(nvm_status);
+                           break;
+                       case COMMAND_ERASE_RANGE: //progress, the erase itself runs in I2C_EraseStep()
+                           I2C_SendBack(erase_rows_left);
+                           break;
+                       case COMMAND_STREAM_READ: //continues at flash_address, no matter how many bytes the previous read took
+                           I2C_SendBack(I2C_NextStreamByte());
+                           break;
                        case COMMAND_START_FIRMWARE://restart and leave bootloader on startup
                            I2C_SendBack(0x00);
-                           flash_memory_set_bootloader_flag(0x01); //set the flag to 1 to jump to program after a reset.
+                           bootloader_handoff = bootloader_handoff_leave; //jump to program after the reset, even without valid application CRC; kept in RAM, no flash write
                            __delay_ms(1);
                            asm("RESET");
                            break;
@@ -201,12 +284,29 @@ void I2C_Communicate(void){
                }
             }
             else{//Write command
+                unsigned char received = SSP2STATbits.BF; //set by a received byte, not by the master's NACK after a read
                 temp = SSP2BUF;
-                if(SSP2STATbits.D_nA){
-                        if(i2c_status == I2C_SLAVE_ADDRESS_RECEIVED){ //previous byte was slave address; this one is command word
+                if(!received){
+                    //nothing to handle: e.g. the start address of COMMAND_STREAM_READ stays, so the next read continues at flash_address
+                }
+                else if(SSP2STATbits.D_nA){
+                        if(i2c_status == I2C_SLAVE_ADDRESS_RECEIVED && i2c_broadcast && temp != COMMAND_WRITE_ROW && temp != COMMAND_WRITE_ROW_RLE){//only row writes are accepted on the general call address
+                            i2c_status = I2C_INITIAL_STATE;
+                        }
+                        else if(i2c_status == I2C_SLAVE_ADDRESS_RECEIVED){ //previous byte was slave address; this one is command word
                             i2c_control_word = temp;
                             i2c_status = I2C_CONTROL_WORD_RECEIVED;
                             flash_address_index = 0;
+                            if(i2c_control_word != COMMAND_GET_STATUS){
+                                nvm_status = NVM_STATUS_DONE;
+                            }
+                            if(i2c_control_word == COMMAND_WRITE_ROW || i2c_control_word == COMMAND_WRITE_ROW_RLE){//row command always carries the whole row
+                                flash_buffer_index = 0;
+                                row_complete = 0;
+                                row_address_ok = 0;
+                                rle_words_left = 0;
+                            }
+                            stream_byte_index = 0;
                             //flash_buffer_index = 0; //Commands should always use whole flash buffer, so set index to 0
                         }
                         else if(i2c_status == I2C_CONTROL_WORD_RECEIVED){
@@ -225,14 +325,88 @@ void I2C_Communicate(void){
                                 if (flash_buffer_index == 64){//guard against index out of range error
                                     flash_buffer_index--;
                                 }
-                                flash_buffer[flash_buffer_index] = temp;
-                                flash_buffer_index++;
+                                I2C_BufferByte(temp);
+                                break;
+                            case COMMAND_WRITE_ROW: //address LSB, address MSB, address CRC, 64 data bytes, CRC of the data bytes followed by the address bytes
+                            case COMMAND_WRITE_ROW_RLE: //address LSB, address MSB, address CRC, tokens until 64 bytes are decoded, CRC
+                                if(flash_address_index == 0){
+                                    flash_address.bytes.LSbyte = temp;
+                                    flash_address_index = 1;
+                                }
+                                else if(flash_address_index == 1){
+                                    flash_address.bytes.MSbyte = temp;
+                                    flash_address_index = 2;
+                                }
+                                else if(flash_address_index == 2){//nothing is erased at an address that got corrupted on the way
+                                    flash_address_index = 3;
+                                    if(I2C_RowAddressValid() && (I2C_UpdateCRC(I2C_UpdateCRC(CRC_INITIAL_REMAINDER, flash_address.bytes.LSbyte), flash_address.bytes.MSbyte) ^ CRC_FINAL_XOR_VALUE) == temp){
+                                        flash_memory_erase(flash_address.word.address, 0); //erase now, so that the latches can be loaded while the data arrives
+                                        I2C_UpdateNVMStatus();
+                                        row_address_ok = 1;
+                                    }
+                                }
+                                else if(flash_buffer_index < 64){
+                                    if(i2c_control_word == COMMAND_WRITE_ROW_RLE){
+                                        I2C_DecodeByte(temp);
+                                    }
+                                    else{
+                                        I2C_BufferByte(temp);
+                                    }
+                                }
+                                else{
+                                    row_crc = temp;
+                                    row_complete = 1;
+                                    row_pending = i2c_broadcast; //nobody reads a status after a broadcast, write the row right away
+                                }
+                                break;
+                            case COMMAND_READ_ROW_CRC: //address LSB, address MSB, number of rows
+                                if(flash_address_index == 0){
+                                    flash_address.bytes.LSbyte = temp;
+                                    flash_address_index = 1;
+                                }
+                                else if(flash_address_index == 1){
+                                    flash_address.bytes.MSbyte = temp;
+                                    flash_address_index = 2;
+                                }
+                                else{
+                                    crc_rows_left = temp;
+                                }
+                                break;
+                            case COMMAND_VERIFY_APPLICATION:
+                                row_crc = temp;
+                                break;
+                            case COMMAND_SET_SLAVE_ADDRESS:
+                                new_slave_address = temp;
+                                break;
+                            case COMMAND_STREAM_READ: //start address LSB, MSB
+                                if(flash_address_index == 1){
+                                    flash_address.bytes.MSbyte = temp;
+                                    flash_address_index = 0;
+                                }
+                                else{
+                                    flash_address.bytes.LSbyte = temp;
+                                    flash_address_index = 1;
+                                }
+                                break;
+                            case COMMAND_ERASE_RANGE: //first row LSB, MSB, number of rows
+                                if(flash_address_index == 0){
+                                    flash_address.bytes.LSbyte = temp;
+                                    flash_address_index = 1;
+                                }
+                                else if(flash_address_index == 1){
+                                    flash_address.bytes.MSbyte = temp;
+                                    flash_address_index = 2;
+                                }
+                                else{
+                                    I2C_StartErase(temp);
+                                }
                                 break;
                         }
                     }
                 }
                 else{//Slave address arrived in write mode
                     i2c_status = I2C_SLAVE_ADDRESS_RECEIVED;
+                    i2c_broadcast = (temp == GENERAL_CALL_ADDRESS);
                 }
             }
         }
@@ -241,16 +415,247 @@ void I2C_Communicate(void){
             i2c_status = I2C_INITIAL_STATE; 
         }	
         SSP2IF = 0;												
+        if(row_pending){//written before the clock is released: SCL stays low (wired-AND over all modules of a broadcast) until the row is committed, the master can not send a STOP or the next row meanwhile
+            row_pending = 0;
+            I2C_WriteRow();
+        }
         SSP2CON1bits.CKP = 1;	//release clock TODO: is this needed here?
      }
 }
 
+unsigned char I2C_UpdateCRC(unsigned char remainder, unsigned char data){
+    data ^= (remainder >> (CRC_WIDTH - 8));
+    return lookup_table[data] ^ (remainder << 8);
+}
+
 unsigned char I2C_CalculateCRC(void){
-    unsigned char data;
     unsigned char remainder = CRC_INITIAL_REMAINDER;
     for(unsigned char i = 0; i < 64; i++){//64 is the size of flash_buffer[]
-        data = flash_buffer[i] ^ (remainder >> (CRC_WIDTH - 8));
-        remainder = lookup_table[data] ^ (remainder << 8);
+        remainder = I2C_UpdateCRC(remainder, flash_buffer[i]);
+    }
+    return (remainder ^ CRC_FINAL_XOR_VALUE);
+}
+
+/*
+ * Stores a received byte in flash_buffer, updates the running CRC (buffer_crc) and loads a write latch as soon as a word
+ * is complete. Word 31 is left for flash_memory_commit(), which starts the write.
+ */
+void I2C_BufferByte(unsigned char data){
+    if(flash_buffer_index == 0){
+        buffer_crc = CRC_INITIAL_REMAINDER;
+    }
+    flash_buffer[flash_buffer_index] = data;
+    buffer_crc = I2C_UpdateCRC(buffer_crc, data);
+    if((flash_buffer_index & 1) && flash_buffer_index < 63){//MSByte of words 0-30
+        flash_memory_load_latch(flash_address.word.address + (flash_buffer_index >> 1), flash_buffer[flash_buffer_index - 1], data);
+    }
+    flash_buffer_index++;
+}
+
+/*
+ * COMMAND_WRITE_ROW_RLE: decodes one received byte into flash_buffer via I2C_BufferByte(), so latches and CRC are handled as for
+ * COMMAND_WRITE_ROW. Runs that would go past the end of the row are cut; an unknown token type decodes to nothing, and the row
+ * is then rejected by its CRC (or as incomplete).
+ */
+void I2C_DecodeByte(unsigned char data){
+    if(rle_words_left == 0){//token
+        rle_type = data & RLE_TYPE_MASK;
+        rle_words_left = (data & RLE_COUNT_MASK) + 1;
+        rle_byte_index = 0;
+        if(rle_type == RLE_BLANK){
+            while(rle_words_left && flash_buffer_index < 64){
+                I2C_BufferByte(0xff);
+                I2C_BufferByte(0x3f);
+                rle_words_left--;
+            }
+            rle_words_left = 0;
+        }
+        else if(rle_type != RLE_LITERAL && rle_type != RLE_REPEAT){
+            rle_words_left = 0;
+        }
+        return;
+    }
+    if(rle_type == RLE_LITERAL){
+        I2C_BufferByte(data);
+        rle_byte_index ^= 1;
+        if(rle_byte_index == 0){
+            rle_words_left--;
+        }
+    }
+    else if(rle_byte_index == 0){//RLE_REPEAT, LSByte
+        rle_LSB = data;
+        rle_byte_index = 1;
+    }
+    else{//RLE_REPEAT, MSByte: the whole run is buffered now
+        while(rle_words_left && flash_buffer_index < 64){
+            I2C_BufferByte(rle_LSB);
+            I2C_BufferByte(data);
+            rle_words_left--;
+        }
+        rle_words_left = 0;
+    }
+}
+
+/*
+ * COMMAND_STREAM_READ: returns the next byte of flash memory starting at flash_address (LSByte of each word first).
+ */
+unsigned char I2C_NextStreamByte(void){
+    if(stream_byte_index == 0){
+        stream_word = flash_memory_read(flash_address.word.address, 0);
+        stream_byte_index = 1;
+        return stream_word & 0xff;
+    }
+    stream_byte_index = 0;
+    flash_address.word.address++;
+    return stream_word >> 8;
+}
+
+/*
+ * Records a failed erase or write in nvm_status (stays NVM_STATUS_ERROR until the next command byte).
+ */
+void I2C_UpdateNVMStatus(void){
+    if(flash_memory_error()){
+        nvm_status = NVM_STATUS_ERROR;
+    }
+}
+
+/*
+ * COMMAND_ERASE_RANGE: sets up the erase of n_rows rows starting at flash_address (0: up to the end of the application region).
+ * Nothing is erased if flash_address is not a row of the application region.
+ */
+void I2C_StartErase(unsigned char n_rows){
+    erase_rows_erased = 0;
+    erase_rows_left = 0;
+    if(!I2C_RowAddressValid()){
+        nvm_status = NVM_STATUS_ERROR;
+        return;
+    }
+    erase_address = flash_address.word.address;
+    unsigned char rows_to_end = (APPLICATION_END - erase_address) >> 5;
+    if(n_rows == 0 || n_rows > rows_to_end){
+        n_rows = rows_to_end;
+    }
+    erase_rows_left = n_rows;
+}
+
+/*
+ * Called from the main loop: erases the next row of a COMMAND_ERASE_RANGE unless it is already blank.
+ * One row per call keeps I2C answering between the ~2.5 ms erase stalls.
+ */
+void I2C_EraseStep(void){
+    if(erase_rows_left == 0){
+        return;
+    }
+    if(!flash_memory_blank(erase_address)){
+        flash_memory_erase(erase_address, 0);
+        I2C_UpdateNVMStatus();
+        erase_rows_erased++;
+    }
+    erase_address += 32;
+    erase_rows_left--;
+}
+
+/*
+ * Returns 1 if flash_address is the beginning of a row in the application region.
+ */
+unsigned char I2C_RowAddressValid(void){
+    if((flash_address.word.address & 0x1f) || flash_address.word.address < APPLICATION_START || flash_address.word.address >= APPLICATION_END){
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Same CRC as I2C_CalculateCRC(), but over the row in flash memory starting at address (LSByte of each word first, as in flash_buffer).
+ */
+unsigned char I2C_CalculateRowCRC(unsigned int address){
+    unsigned int word;
+    unsigned char remainder = CRC_INITIAL_REMAINDER;
+    for(unsigned char i = 0; i < 32; i++){//32 words in a row
+        word = flash_memory_read(address, 0);
+        remainder = I2C_UpdateCRC(remainder, word & 0xff);
+        remainder = I2C_UpdateCRC(remainder, word >> 8);
+        address++;
+    }
+    return (remainder ^ CRC_FINAL_XOR_VALUE);
+}
+
+/*
+ * COMMAND_READ_ROW_CRC: returns the CRC of the row at flash_address and moves on to the next row.
+ * Once the requested number of rows has been reported, 0x00 is sent.
+ */
+unsigned char I2C_NextRowCRC(void){
+    unsigned char crc;
+    if(crc_rows_left == 0){
+        return 0x00;
+    }
+    crc = I2C_CalculateRowCRC(flash_address.word.address);
+    flash_address.word.address += 32;
+    crc_rows_left--;
+    return crc;
+}
+
+/*
+ * Executes COMMAND_WRITE_ROW on the received address and flash_buffer, returns a ROW_STATUS_... byte.
+ */
+unsigned char I2C_WriteRow(void){
+    if(!row_complete){
+        return ROW_STATUS_INCOMPLETE;
+    }
+    row_complete = 0; //a repeated read must not write the row again
+    if(!row_address_ok){//invalid, or the address check byte did not match
+        return ROW_STATUS_ADDRESS_ERROR;
+    }
+    if((I2C_UpdateCRC(I2C_UpdateCRC(buffer_crc, flash_address.bytes.LSbyte), flash_address.bytes.MSbyte) ^ CRC_FINAL_XOR_VALUE) != row_crc){//the address is covered too: a corrupted one must not overwrite another row
+        return ROW_STATUS_CRC_ERROR;
+    }
+    flash_memory_commit(flash_address.word.address + 31, flash_buffer[62], flash_buffer[63]); //erased and words 0-30 loaded while receiving
+    I2C_UpdateNVMStatus();
+    if(!flash_memory_verify(flash_address.word.address, flash_buffer, 64)){
+        return ROW_STATUS_VERIFY_ERROR;
+    }
+    return ROW_STATUS_OK;
+}
+
+/*
+ * CRC of the whole application region APPLICATION_START - APPLICATION_END-1, as one message (LSByte of each word first).
+ */
+unsigned char I2C_CalculateApplicationCRC(void){
+    unsigned int word;
+    unsigned char remainder = CRC_INITIAL_REMAINDER;
+    for(unsigned int address = APPLICATION_START; address < APPLICATION_END; address++){
+        word = flash_memory_read(address, 0);
+        remainder = I2C_UpdateCRC(remainder, word & 0xff);
+        remainder = I2C_UpdateCRC(remainder, word >> 8);
     }
     return (remainder ^ CRC_FINAL_XOR_VALUE);
+}
+
+/*
+ * COMMAND_VERIFY_APPLICATION: compares the application CRC with the one received (row_crc), stores it if they match.
+ * A blank application region is never stored as valid.
+ */
+unsigned char I2C_VerifyApplication(void){
+    application_crc = I2C_CalculateApplicationCRC();
+    if(I2C_ApplicationBlank()){
+        return ROW_STATUS_BLANK_ERROR;
+    }
+    if(application_crc != row_crc){
+        return ROW_STATUS_CRC_ERROR;
+    }
+    flash_memory_set_application_crc(application_crc);
+    I2C_UpdateNVMStatus();
+    return ROW_STATUS_OK;
+}
+
+/*
+ * Returns 1 if every row of the application region is erased, e.g. after an upload of a hex file linked without the 0x1000 offset.
+ */
+unsigned char I2C_ApplicationBlank(void){
+    for(unsigned int address = APPLICATION_START; address < APPLICATION_END; address += 32){
+        if(!flash_memory_blank(address)){
+            return 0;
+        }
+    }
+    return 1;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #define I2C_INITIAL_STATE           0x00
 #define I2C_SLAVE_ADDRESS_RECEIVED  0x01
 #define I2C_CONTROL_WORD_RECEIVED   0x02
+#define I2C_READ_STARTED            0x03    //slave address arrived in read mode: no parameter bytes until the next write address
 #define COMMAND_SET_FLASH_ADDRESS   0x01
 #define COMMAND_WRITE_TO_BUFFER     0x02
 #define COMMAND_READ_FROM_FLASH     0x03
@@ -9,6 +10,33 @@
 #define COMMAND_START_FIRMWARE      0x06
 #define COMMAND_CONTINUE_READ_FROM_FLASH 0x07   //the Arduino used for hex file uploading can not handle more than 32 bytes, which is half the buffer size -> need command to read out second half
 #define COMMAND_RESET               0x08
+#define COMMAND_WRITE_ROW           0x09    //address LSB, address MSB, address CRC, 64 data bytes, CRC (of data, address LSB, address MSB) in one transaction; erase, write and verify are done on the device
+#define COMMAND_READ_ROW_CRC        0x0A    //address LSB, address MSB, number of rows; read back one CRC (same as I2C_CalculateCRC()) per row
+#define COMMAND_VERIFY_APPLICATION  0x0B    //expected CRC of 0x1000-0x1FFF; read back ROW_STATUS_OK (CRC stored, application starts on boot) or ROW_STATUS_CRC_ERROR, then the calculated CRC
+#define COMMAND_SET_SLAVE_ADDRESS   0x0C    //new 7-bit I2C address of this bootloader, stored in User ID 0x8002 and used after the next reset; read back 1 byte (NVM_STATUS_...)
+#define COMMAND_GET_STATUS          0x0D    //read back 1 byte: NVM_STATUS_... of the erase/write operations since the last command
+#define COMMAND_ERASE_RANGE         0x0E    //first row LSB, MSB, number of rows (0: up to the end of the application region); erased in the background, read back rows left and rows erased
+#define COMMAND_WRITE_ROW_RLE       0x0F    //as COMMAND_WRITE_ROW, but the 64 data bytes are run-length coded (RLE_... tokens); CRC is that of the decoded row and the address
+#define COMMAND_STREAM_READ         0x10    //start address LSB, MSB; then read any number of bytes (LSByte, MSByte of each word), the address advances across rows
+
+#define GENERAL_CALL_ADDRESS        0x00    //all bootloaders accept COMMAND_WRITE_ROW(_RLE) on this address (broadcast), nothing else
+
+#define RLE_LITERAL                 0x00    //token of COMMAND_WRITE_ROW_RLE: n words follow (LSByte, MSByte each)
+#define RLE_REPEAT                  0x40    //token: one word follows, written n times
+#define RLE_BLANK                   0x80    //token: n erased words (0x3FFF), no data
+#define RLE_TYPE_MASK               0xE0
+#define RLE_COUNT_MASK              0x1F    //n - 1 in the lower 5 bits, so one token covers up to a whole row
+
+#define ROW_STATUS_OK               0x00    //status bytes returned by COMMAND_WRITE_ROW and COMMAND_VERIFY_APPLICATION
+#define ROW_STATUS_CRC_ERROR        0x02    //received data and address do not match CRC, the row has been erased but not written
+#define ROW_STATUS_VERIFY_ERROR     0x03    //row read back from flash differs from the received data
+#define ROW_STATUS_INCOMPLETE       0x04    //fewer than 68 bytes received after the command byte
+#define ROW_STATUS_ADDRESS_ERROR    0x05    //address is not the beginning of a row in the application region, or does not match the address CRC; nothing has been erased
+#define ROW_STATUS_BLANK_ERROR      0x06    //COMMAND_VERIFY_APPLICATION: the application region is blank, no CRC stored (the bootloader would jump into erased flash)
+#define NVM_STATUS_DONE             0x00    //all NVM operations finished without error
+#define NVM_STATUS_ERROR            0x02    //an erase or write failed (WRERR)
+#define APPLICATION_START           0x1000  //first word of the application region; below it is the (write protected) bootloader
+#define APPLICATION_END             0x2000  //first word after the application region
 
 #define CRC_WIDTH 8
 #define CRC_TOPBIT (1 << (CRC_WIDTH - 1))
@@ -23,4 +51,18 @@
 void I2C_SlaveInit(unsigned char slave_address);
 void I2C_SendBack(unsigned char data);
 void I2C_Communicate(void);
-unsigned char I2C_CalculateCRC(void);
\ No newline at end of file
+unsigned char I2C_CalculateCRC(void);
+void I2C_BufferByte(unsigned char data);
+void I2C_DecodeByte(unsigned char data);
+unsigned char I2C_NextStreamByte(void);
+unsigned char I2C_RowAddressValid(void);
+void I2C_UpdateNVMStatus(void);
+void I2C_StartErase(unsigned char n_rows);
+void I2C_EraseStep(void);
+unsigned char I2C_WriteRow(void);
+unsigned char I2C_UpdateCRC(unsigned char remainder, unsigned char data);
+unsigned char I2C_CalculateRowCRC(unsigned int address);
+unsigned char I2C_NextRowCRC(void);
+unsigned char I2C_CalculateApplicationCRC(void);
+unsigned char I2C_VerifyApplication(void);
+unsigned char I2C_ApplicationBlank(void);
\ No newline at end of file
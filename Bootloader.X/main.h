@@ -12,5 +12,8 @@ extern unsigned char flash_address_index;
 extern unsigned char flash_buffer[64];
 extern unsigned char flash_buffer_index;
 extern unsigned char reset_timer;
+#define startup_window_ms 100 //I2C is served this long before an application with valid CRC is started; a transaction in it keeps the bootloader
+
 void Initialize(void);
-void LeaveBootloader(void);
\ No newline at end of file
+void LeaveBootloader(void);
+unsigned char StartupWindow(void);
\ No newline at end of file
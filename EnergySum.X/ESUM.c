@@ -35,9 +35,18 @@
 
 
 unsigned char memory[256];
+unsigned char trace[trace_length];    //see trace_entries in main.h
+unsigned char trace_head = 0;         //next entry to write, i.e. the oldest one
+unsigned char trace_read = 0;         //next byte streamed from TRC_data
 bool next_is_mem_addr = false;
 bool first_read_back = true; //helpful variable: when reading back multiple values, D_nA will be 1, which normally would correspond to situation when global address has just been received.
 unsigned char memory_address = 0;  //current index of memory[]
+unsigned char i2c_target = i2c_target_own; //addressed as, see I2C_SlaveInit()
+bool bt_running = false;    //baseline tracking has captured its reference ODAC code
+uint16_t bt_code = 0;       //ODAC code currently set (by ODAC_flag, BL_flag or baseline tracking), kept apart from the ODAC_MSB/LSB shadow registers
+int16_t bt_correction = 0;  //bt_code minus the ODAC code at the start of tracking
+unsigned char bt_ticks = 0; //10 ms ticks since last tracking step
+__persistent volatile unsigned char reset_counters[reset_causes] __at(reset_counters_address); //not cleared at startup, see Counters_Init()
  
  /*
   * interrupt enable: 101/491
@@ -47,15 +56,37 @@ unsigned char memory_address = 0;  //current index of memory[]
   *           
   */
  void __interrupt() isr(void){
+     Profile_Enter();
+#if profiler_enabled
+     if(PIR1bits.TMR1IF){
+         profiler_overflows++;
+         PIR1bits.TMR1IF = 0;
+     }
+#endif
      if(SSP2IF == 1){
+         Counter_Increment(CNT_isr);
          if(SSP2STATbits.R_nW == 1 ){//Read command
             if((first_read_back == 1) && (SSP2STATbits.D_nA == 1)){//1. before each command, it is assumed that a data byte was transmitted first in either way -> D_nA bit is high right after receiving global address
                 memory[global_address_store] = SSP2BUF;
+                Counter_Increment(CNT_rx);
                 SSP2IF = 0;
             }
             else{//2. - N. read back memory and increment array pointer
-                SSP2BUF = memory[memory_address];
-                memory_address++;
+                if(SSP2STATbits.D_nA == 0){//address byte: reads are only answered at the own address
+                    i2c_target = ((SSP2BUF & 0xfe) == SSP2ADD) ? i2c_target_own : i2c_target_other;
+                }
+                if(i2c_target != i2c_target_own){
+                    SSP2BUF = 0xff; //leaves SDA to the addressed module
+                }
+                else if(memory_address == TRC_data){
+                    SSP2BUF = trace[trace_read];
+                    trace_read = (trace_read + 1) & (trace_length - 1);
+                }
+                else{
+                    SSP2BUF = memory[memory_address];
+                    memory_address++;
+                }
+                Counter_Increment(CNT_tx);
                 SSP2CON1bits.CKP = 1;
                 first_read_back = 0; //the first byte has been read back. D_nA will be 1, but should not run 
                 SSP2IF = 0;
@@ -66,17 +97,40 @@ unsigned char memory_address = 0;  //current index of memory[]
                  if(next_is_mem_addr){//receiving memory[] address to be written to
                      memory_address = SSP2BUF;
                      next_is_mem_addr = false;
+                     if(memory_address == TRC_data){
+                         trace_read = trace_head; //stream from the oldest entry
+                     }
+                     Counter_Increment(CNT_rx);
                      SSP2IF = 0;
                  }
                  else{
-                     memory[memory_address] = SSP2BUF;
+                     unsigned char data = SSP2BUF;
+                     if(i2c_target == i2c_target_own || (i2c_target == i2c_target_group && Group_Writable(memory_address))
+                             || (i2c_target == i2c_target_general_call && memory_address == GRP_apply)){
+                         memory[memory_address] = data;
+                         Trace(memory_address, data, trace_write);
+                     }
                      memory_address++;
+                     Counter_Increment(CNT_rx);
                      SSP2IF = 0; 
                  }
              }
              else{//Read global address from buffer
                 memory_address = SSP2BUF;
                 next_is_mem_addr = true; //next byte received will be the memory[] address
+                if(memory_address == SSP2ADD){
+                    i2c_target = i2c_target_own;
+                }
+                else if(memory_address == i2c_group_address){
+                    i2c_target = i2c_target_group;
+                }
+                else if(memory_address == 0){
+                    i2c_target = i2c_target_general_call;
+                }
+                else{
+                    i2c_target = i2c_target_other;
+                }
+                Counter_Increment(CNT_rx);
                 if(SSP2CON2bits.SEN == 1){//if clock stretching enabled, release SCL
                     SSP2CON1bits.CKP = 1;
                 }
@@ -87,7 +141,7 @@ unsigned char memory_address = 0;  //current index of memory[]
         first_read_back = 1; //if stop detected, clear "first byte read back" (i. e. next read command's first byte will also be detected as first byte read back)
     }
      }
-     
+     Profile_Exit();
  } 
  
  /*
@@ -97,11 +151,22 @@ unsigned char memory_address = 0;  //current index of memory[]
  */
 
 void SPI_Process(void){
+    if(memory[GRP_apply] > 0){//group command: same as setting the flags, so that all modules update at once
+        if(memory[GRP_apply] & 0b01){
+            memory[MDAC_flag] |= 0b010;
+        }
+        if(memory[GRP_apply] & 0b10){
+            memory[ODAC_flag] |= 0b01;
+        }
+        memory[GRP_apply] = 0;
+        Trace_Done(GRP_apply);
+    }
     unsigned char mdac_flag_bits = memory[MDAC_flag] & 0b111; //ignore MDAC channel bits to check for tasks
     if(mdac_flag_bits > 0){
         
         if(mdac_flag_bits & 0b010){//write all bit is set
             MDAC_LoadUpdate(MDAC_1);
+            Counter_Increment(CNT_spi);
             memory[MDAC_flag] &= 0b11111101;//clear flag
         }
         if(mdac_flag_bits & 0b001){//write single bit is on
@@ -113,12 +178,15 @@ void SPI_Process(void){
                 Set_CS(1);
                 MDAC_LoadUpdateSingle(MDAC_index, memory[mdi]); //MDAC_index goes from 1 to 24, but memory[0] contains value for MDAC 1
                 Set_CS(2);
+                Counter_Increment(CNT_spi);
                 memory[MDAC_flag] &= 0b11111110;//clear flag  
         }
         if(mdac_flag_bits & 0b100){//read all
             MDAC_Read();
+            Counter_Increment(CNT_spi);
             memory[MDAC_flag] &= 0b11111011;//clear flag
         }
+        Trace_Done(MDAC_flag);
     }
     if(memory[ODAC_flag] > 0){
         MDAC_SendToLast(MDAC_ControlWord, MDAC_disable_command); //disable MDAC, otherwise it would interfere in SPI communication
@@ -131,6 +199,9 @@ void SPI_Process(void){
             Set_CS(0);
             ODAC_IO(VOL_DAC0_ADDRESS, 1, odac_val);
             Set_CS(2);
+            bt_code = odac_val;
+            bt_running = false; //baseline tracking continues from the new value
+            Counter_Increment(CNT_spi);
             memory[ODAC_flag] &= 0b11111110;//clear flag
         }
         if(memory[ODAC_flag] & 0b10){//Read
@@ -141,11 +212,13 @@ void SPI_Process(void){
             memory[ODAC_LSB] = (odac_val & 0xff);
             odac_val >>= 8;
             memory[ODAC_MSB] = (odac_val & 0xff);
+            Counter_Increment(CNT_spi);
             memory[ODAC_flag] &= 0b11111101;
         }
             Set_CS(1);
             MDAC_Init(0, 0, 1); //TODO: sending  MDAC_SendToLast(MDAC_ControlWord, MDAC_enable_command); did not work, why?
             Set_CS(2);
+            Trace_Done(ODAC_flag);
     }
     
 }
@@ -156,8 +229,10 @@ void SPI_Process(void){
 void I2C_Process(void){
     if((memory[I2C_flag] & 0b1) == 0b1){
         SSP2CON1bits.SSPEN = 0; //Disable SSP2 (I2C) module
-        I2C_SlaveInit(memory[I2C_store]);
+        I2C_SlaveInit(memory[I2C_store], memory[GRP_flag], memory[GRP_address]);
+        Counter_Increment(CNT_i2c);
         memory[I2C_flag] &= 0b11111110; //clear last bit
+        Trace_Done(I2C_flag);
     }
 }
 
@@ -176,14 +251,80 @@ void ADC_Process(void){
         __delay_ms(1000);
         memory[ADC_MSB+1] = (adc_value & 0xff);
         memory[ADC_MSB] = adc_value >> 8;
+        Counter_Increment(CNT_adc);
         memory[ADC_flag] &= 0b11111110;
+        Trace_Done(ADC_flag);
     }
     if(memory[BL_flag] > 0){
         if(memory[BL_flag] == 0b1){
-            SetBaseline();
+            uint16_t odac_val = SetBaseline();
+            memory[ODAC_MSB+1] = (odac_val & 0xff);
+            memory[ODAC_MSB] = odac_val >> 8;
+            bt_code = odac_val;
+            bt_running = false; //baseline tracking continues from the new value
+            Counter_Increment(CNT_adc);
             memory[BL_flag] &= 0b11111110;
+            Trace_Done(BL_flag);
+        }
+    }
+}
+
+/*
+ * BT_flag: bit 0: baseline tracking on.
+ * Every BT_interval ticks, the averaged baseline is compared to baseline_ADC_value. If it is outside the deadband,
+ * the ODAC code is moved by BT_step towards it, keeping the total correction within +- BT_limit.
+ * A higher ODAC code gives a lower ADC reading, see SetBaseline().
+ */
+void Tracking_Process(void){
+    if(Timebase_Tick() && bt_ticks < 255){
+        bt_ticks++;
+    }
+    if((memory[BT_flag] & 0b1) == 0){
+        bt_running = false;
+        return;
+    }
+    if(!bt_running){//take the last applied ODAC code as reference; ODAC_MSB/LSB may hold a value the host or group has not applied yet
+        bt_correction = 0;
+        bt_ticks = 0;
+        bt_running = true;
+    }
+    else if(bt_ticks >= memory[BT_interval]){
+        bt_ticks = 0;
+        uint16_t baseline = Baseline_Measure();
+        memory[BT_avg_MSB+1] = (baseline & 0xff);
+        memory[BT_avg_MSB] = baseline >> 8;
+        Counter_Increment(CNT_bt);
+        int16_t step = 0;
+        if(baseline > baseline_ADC_value + memory[BT_deadband]){//baseline too low, more offset needed
+            step = memory[BT_step];
+            if(bt_code + step > 0xfff){
+                step = 0xfff - bt_code;
+            }
+        }
+        else if(baseline + memory[BT_deadband] < baseline_ADC_value){//baseline too high
+            step = -memory[BT_step];
+            if(bt_code < memory[BT_step]){
+                step = -bt_code;
+            }
+        }
+        if(memory[BT_limit] != 0){
+            if(bt_correction + step > memory[BT_limit]){
+                step = memory[BT_limit] - bt_correction;
+            }
+            if(bt_correction + step < -memory[BT_limit]){
+                step = -memory[BT_limit] - bt_correction;
+            }
+        }
+        if(step != 0){
+            bt_code += step;
+            bt_correction += step;
+            ODAC_SetValue(bt_code);
         }
     }
+    memory[BT_corr_MSB+1] = (bt_correction & 0xff);
+    memory[BT_corr_MSB] = (bt_correction >> 8) & 0xff;
+    memory[BT_code_MSB+1] = (bt_code & 0xff);
+    memory[BT_code_MSB] = bt_code >> 8;
 }
 
 void Testpulser_Do(void){
@@ -215,15 +356,105 @@ void Testpulser_Do(void){
  */
 void Testpulser_Process(void){
     if(memory[TP_flag] > 0){
+        Counter_Increment(CNT_tp);
         Testpulser_Do();
         memory[TP_flag] = 0;
+        Trace_Done(TP_flag);
+    }
+}
+
+/*
+ * Counters window (CNT_flag): called once at startup, counts the reset that started the firmware by its cause in PCON0
+ * and sets the PCON0 flags back for the next one. After power-on or brown-out, the RAM kept across RESET is random,
+ * so the reset counters start from 0 with that reset counted. Started through the bootloader, this has already been
+ * done there (it re-arms nPOR and nBOR to pass its RAM handoff).
+ */
+void Counters_Init(void){
+    unsigned char cause = reset_causes; //none found: started without a reset
+    unsigned char i;
+    memory[CNT_pcon] = PCON0;
+    if(PCON0bits.nPOR == 0 || PCON0bits.nBOR == 0){//RAM is random, counters not kept
+        for(i = 0; i < reset_causes; i++){
+            reset_counters[i] = 0;
+        }
+        cause = PCON0bits.nPOR == 0 ? 0 : 1;
+    }
+    else if(PCON0bits.nRMCLR == 0){
+        cause = 2;
+    }
+    else if(PCON0bits.nRWDT == 0 || PCON0bits.nWDTWV == 0){
+        cause = 3;
+    }
+    else if(PCON0bits.nRI == 0){
+        cause = 4;
+    }
+    else if(PCON0bits.STKOVF == 1 || PCON0bits.STKUNF == 1){
+        cause = 5;
+    }
+    if(cause < reset_causes && reset_counters[cause] < 255){
+        reset_counters[cause]++;
+    }
+    PCON0 = 0b00111111; //active low flags to 1, stack flags to 0
+    for(i = 0; i < reset_causes; i++){
+        memory[CNT_resets + i] = reset_counters[i];
+    }
+}
+
+/*
+ * Clears every counter of the window; CNT_pcon is kept.
+ */
+void Counters_Clear(void){
+    unsigned char i;
+    unsigned char interrupts = INTCONbits.GIE;
+    INTCONbits.GIE = 0; //isr() increments CNT_isr, CNT_rx and CNT_tx
+    for(i = CNT_isr; i < CNT_wcol + 2; i++){
+        memory[i] = 0;
     }
+    for(i = CNT_spi; i < CNT_misc + 2; i++){
+        memory[i] = 0;
+    }
+    for(i = 0; i < reset_causes; i++){
+        reset_counters[i] = 0;
+        memory[CNT_resets + i] = 0;
+    }
+    INTCONbits.GIE = interrupts;
+}
+
+/*
+ * Command trace (TRC_flag, trace_entries in main.h). Timer0 runs free on LFINTOSC (31 kHz) / 32, 16-bit, so the time
+ * stamps keep counting while a handler blocks the main loop.
+ */
+void Trace_Clear(void){
+    unsigned char i;
+    unsigned char interrupts = INTCONbits.GIE; //also called by Trace_Init(), before I2C_SlaveInit() turns interrupts on
+    INTCONbits.GIE = 0;     //isr() adds host writes
+    for(i = 0; i < trace_length; i++){
+        trace[i] = 0xff;
+    }
+    trace_head = 0;
+    trace_read = 0;
+    INTCONbits.GIE = interrupts;
+}
+
+void Trace_Init(void){
+    T0CON1 = 0b10000101;    //LFINTOSC, synchronized, prescaler 1:32
+    T0CON0 = 0b10010000;    //enabled, 16-bit, postscaler 1:1
+    Trace_Clear();
+}
+
+//A handler finished the command of the given flag register
+void Trace_Done(unsigned char flag){
+    unsigned char interrupts = INTCONbits.GIE;
+    INTCONbits.GIE = 0;
+    Trace(flag, memory[flag], trace_done);
+    INTCONbits.GIE = interrupts;
 }
 
 void Misc_Process(void){//UID, LED functions
     //reads out 24AA025E48 chip unique address when memory[UID_flag] is set to 1
     if(memory[UID_flag] == 0b1){
             memory[UID_flag] = 0;
+            Counter_Increment(CNT_misc);
             INTCONbits.GIE = 0;//Disable interrupts for the time being
             SSP2IF = 0; //TODO: maybe not needed?
             unsigned char data[6] = {0, 0, 0, 0, 0, 0};
@@ -232,7 +463,8 @@ void Misc_Process(void){//UID, LED functions
             for(unsigned char i = 0; i < data_length; i++){
                 memory[UID_store+i] = data[i];
             }
-            I2C_SlaveInit(memory[I2C_store]); //global interrupt will be enabled by this function
+            I2C_SlaveInit(memory[I2C_store], memory[GRP_flag], memory[GRP_address]); //global interrupt will be enabled by this function
+            Trace_Done(UID_flag);
 
             
         }
@@ -255,12 +487,30 @@ void Misc_Process(void){//UID, LED functions
                 
         }
 
+        Counter_Increment(CNT_misc);
         memory[LED_flag] = 0;
+        Trace_Done(LED_flag);
+    }
+    if(memory[CNT_flag] & 0b1){
+        Counters_Clear();
+        memory[CNT_flag] &= 0b11111110;
+        Trace_Done(CNT_flag);
     }
+    if(memory[TRC_flag] & 0b1){
+        Trace_Clear();
+        memory[TRC_flag] &= 0b11111110;
+        Trace_Done(TRC_flag);
+    }
+#if profiler_enabled
+    if(memory[PRF_flag] & 0b1){
+        Profiler_Clear();
+        memory[PRF_flag] &= 0b11111110;
+        Trace_Done(PRF_flag);
+    }
+#endif
     if (memory[reset_flag] != 0x00){//if reset_flag is 0, nothing happens; if it is 1, only reboot happens; if it is 2, reboot into bootloader happens.
         if(memory[reset_flag] == 0x02){
-            flash_memory_set_bootloader_flag();
-            __delay_ms(10);
+            bootloader_handoff = bootloader_handoff_stay; //survives the RESET, no flash write needed
         }
         asm("RESET");
     }
@@ -270,6 +520,8 @@ void main(void) {
     __delay_ms(100); //wait a little for the power-on voltage instabilities to settle
     memory[I2C_store] = i2c_default_address;
     memory[reset_flag] = 0x00; //initialize flag to 0 to avoid accidental resets.
+    Counters_Init();
+    Trace_Init();
     //Set up LED pins
     TRISAbits.TRISA2 = 0;       //LED1
     TRISAbits.TRISA4 = 0;       //LED2
@@ -307,7 +559,7 @@ void main(void) {
     
     //Initialize I2C slave on MSSP2 register with default i2c address. It can be changed, see I2C_flag definition.
     SSP2CON1bits.SSPEN = 0; //Disable SSP2 (I2C) module
-    I2C_SlaveInit(memory[I2C_store]);
+    I2C_SlaveInit(memory[I2C_store], memory[GRP_flag], memory[GRP_address]); //GRP_flag is 0: no general call or group address
 
     
     //store firmware version
@@ -316,6 +568,16 @@ void main(void) {
     ODAC_SelectReference(1);//Set up ODAC with internal band gap as reference
     ODAC_SetGain(1);        
     
+    //Baseline tracking defaults, see BT_flag
+    memory[BT_deadband] = 4;
+    memory[BT_step] = 1;
+    memory[BT_interval] = 10;
+    memory[BT_limit] = 0x80;
+    Timebase_Init();
+#if profiler_enabled
+    Profiler_Init();
+#endif
+    
     //Write "MDAC" to help when looking at i2cdump
     memory[0x1c] = 0x4d;
     memory[0x1d] = 0x44;
@@ -334,14 +596,33 @@ void main(void) {
     memory[0x4c] = 0x55;
     memory[0x4d] = 0x49;
     memory[0x4e] = 0x44;
+    //Write "BLT"
+    memory[0x6c] = 0x42;
+    memory[0x6d] = 0x4c;
+    memory[0x6e] = 0x54;
+    //Write "GRP"
+    memory[0x9c] = 0x47;
+    memory[0x9d] = 0x52;
+    memory[0x9e] = 0x50;
+    //Write "TRC"
+    memory[0xac] = 0x54;
+    memory[0xad] = 0x52;
+    memory[0xae] = 0x43;
+    //Write "CNT"
+    memory[0x7c] = 0x43;
+    memory[0x7d] = 0x4e;
+    memory[0x7e] = 0x54;
     
     while(1){
         asm("CLRWDT");              //Clear watchdog timer
-        SPI_Process();            //Reads/updates MDACs on MSSP1 
-        I2C_Process();            //Reinitializes slave if needed
-        ADC_Process();
-        Testpulser_Process();     //Produces testpulses
-        Misc_Process();
+        Counter_Increment(CNT_loops);
+        Profile(SPI_Process, PRF_spi);            //Reads/updates MDACs on MSSP1 
+        Profile(I2C_Process, PRF_i2c);            //Reinitializes slave if needed
+        Profile(ADC_Process, PRF_adc);
+        Profile(Tracking_Process, PRF_bt);        //Keeps baseline in place if BT_flag is set
+        Profile(Testpulser_Process, PRF_tp);      //Produces testpulses
+        Profile(Misc_Process, PRF_misc);
+        Profile_Collect();                        //Records the duration of the last isr()
      }
 }
 
@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "SPI.h"
+#include "I2C.h"
 
 
 /*
@@ -173,7 +174,16 @@ void ReadGlobalAddress(unsigned char* data, unsigned char data_length){//data sh
  * SCL pin: RC3 (pin 7)
  * SDA pin: RC6 (pin 8)
  */
-void I2C_SlaveInit(unsigned char slave_address){    //slave_address of the form: x S6 S5 ... S0!
+/*
+ * group_options: i2c_general_call_enable answers address 0 (GCEN), i2c_group_enable also answers group_address.
+ * MSSP2 has one address register: SSP2MSK masks the bits in which own and group address differ, so the module
+ * acknowledges every address of that window. isr() sorts the transactions with i2c_group_address: writes to other
+ * addresses of the window are dropped, reads of them are answered with 0xff, which leaves SDA to the addressed module.
+ * Group and own address should therefore differ in as few bits as possible.
+ */
+unsigned char i2c_group_address = 0xff; //8-bit form (group_address << 1), 0xff: no group address
+
+void I2C_SlaveInit(unsigned char slave_address, unsigned char group_options, unsigned char group_address){    //slave_address of the form: x S6 S5 ... S0!
     GIE = 0;             //Disable interrupts for the duration of the setup
     //INTCONbits.PEIE = 0;            //Prevents other peripherials from interrupting set-up      
     //Change RC3 and RC6 to digital pins, 157
@@ -192,6 +202,12 @@ void I2C_SlaveInit(unsigned char slave_address){    //slave_address of the form:
     unsigned char address = slave_address;
     address <<= 1;              //364/491
     SSP2ADD = address;      
+    i2c_group_address = 0xff;
+    SSP2MSK = 0xff;             //all address bits compared
+    if(group_options & i2c_group_enable){
+        i2c_group_address = group_address << 1;
+        SSP2MSK = ~(address ^ i2c_group_address);
+    }
     //p. 325 Note: SDA input: SSPDATPPS, SCL input: SSPCLKPPS, outputs: RxyPPS, see p. 162
     RC6PPS = 0b11011;   //set RC6 to SDA2
     SSP2DATPPS = 0b10110;  
@@ -200,7 +216,7 @@ void I2C_SlaveInit(unsigned char slave_address){    //slave_address of the form:
     //p. 360
     SSP2CON1 = 0b00110110;  
     //p. 362
-    SSP2CON2 = 0b0; //default settings
+    SSP2CON2 = (group_options & i2c_general_call_enable) ? 0b10000000 : 0b0; //GCEN, otherwise default settings
     SSP2CON3 = 0b0;
     //p. 363, also 325 30.4.4 SDA hold time
     SSP2IF = 0;
@@ -11,7 +11,16 @@ void I2C_Stop(void);
 void I2C_WriteByte(unsigned char control_byte, unsigned char data);
 void I2C_ReadAddress(unsigned char control_byte_write, unsigned char control_byte_read, unsigned char memory_address, unsigned char* data, unsigned char data_length);
 void ReadGlobalAddress(unsigned char* data, unsigned char data_length);
-void I2C_SlaveInit(unsigned char slave_address);
+void I2C_SlaveInit(unsigned char slave_address, unsigned char group_options, unsigned char group_address);
+
+#define i2c_general_call_enable 0b01 //group_options of I2C_SlaveInit(), same bits as memory[GRP_flag]
+#define i2c_group_enable        0b10
+#define i2c_target_own          0   //addressed by the own address
+#define i2c_target_group        1   //group address
+#define i2c_target_general_call 2   //address 0, also used by the bootloaders (broadcast rows): only GRP_apply is written
+#define i2c_target_other        3   //another address inside the SSP2MSK window, ignored
+
+extern unsigned char i2c_group_address;
 
 #endif
 
@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <xc.h>
+#include "main.h" //memory[] counters
 
 #define CS_DAC LATCbits.LATC0
 #define CS_MDAC LATCbits.LATC1
@@ -104,6 +105,9 @@ unsigned char SPI_IO_Byte(unsigned char data){
     do{
         SSP1CON1bits.WCOL = 0;
         SSP1BUF = data;
+        if(SSP1CON1bits.WCOL){
+            Counter_Increment(CNT_wcol);
+        }
     }while(SSP1CON1bits.WCOL);
     while(SSP1IF == 0); //wait until transmission complete
     read_data = SSP1BUF;
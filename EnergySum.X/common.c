@@ -5,6 +5,12 @@
 #include "ODAC.h"
 #include "ADC.h"
 #include "I2C.h"
+#include "main.h" //memory[], PRF_table
+
+__persistent volatile unsigned int bootloader_handoff __at(bootloader_handoff_address); //not cleared at startup; the bootloader reserves the same address
+volatile uint16_t profiler_overflows = 0; //Timer1 overflows, counted in isr() when profiler_enabled
+volatile uint16_t profiler_isr_ticks = 0; //duration of the last isr(), latched by Profile_Exit() and recorded by Profiler_Isr()
+volatile unsigned char profiler_isr_pending = 0; //profiler_isr_ticks not recorded yet; isr() leaves it alone until then
 
 
 
@@ -53,6 +59,116 @@ uint16_t SetBaseline(void){
     return ODAC_value;
 }
 
+//Returns the average of 2^BT_avg_shift ADC readings of the baseline pin
+uint16_t Baseline_Measure(void){
+    uint16_t sum = 0;
+    ADC_Configure(0);           //0 is Baseline
+    for(unsigned char i = 0; i < (1 << BT_avg_shift); i++){
+        sum += ADC_Measure();   //10-bit values, 8 of them still fit into 16 bits
+    }
+    return sum >> BT_avg_shift;
+}
+
+/*
+ * Timer4 is used as a 10 ms time base for main loop tasks that need rate limiting. Polled, no interrupt. See 192/491
+ * Fosc/4 = 8 MHz, prescaler 1:64 -> 125 kHz, PR4 = 249 -> 500 Hz, postscaler 1:5 -> 100 Hz
+ */
+void Timebase_Init(void){
+    T4CONbits.T4CKPS = 0b11;        //Prescaler: 64
+    T4CONbits.T4OUTPS = 0b0100;     //Postscaler: 5
+    PR4 = 249;
+    PIE2bits.TMR4IE = 0;
+    TMR4IF = 0;
+    TMR4ON = 1; //start timer
+}
+
+//Returns 1 (and clears the flag) if a 10 ms tick has passed since the last call, 0 otherwise
+unsigned char Timebase_Tick(void){
+    if(TMR4IF){
+        TMR4IF = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Profiler (profiler_enabled in main.h): Timer1 runs free on Fosc/4, i.e. one count per instruction cycle (125 ns),
+ * extended to 32 bits by the overflow interrupt. Durations are stored in memory[PRF_table].
+ */
+void Profiler_Init(void){
+    T1CON = 0;                  //Fosc/4, prescaler 1:1, stopped
+    TMR1H = 0;
+    TMR1L = 0;
+    PIR1bits.TMR1IF = 0;
+    PIE1bits.TMR1IE = 1;        //PEIE and GIE are set by I2C_SlaveInit()
+    T1CONbits.TMR1ON = 1;
+    Profiler_Clear();
+}
+
+void Profiler_Clear(void){
+    unsigned char i;
+    unsigned char interrupts = INTCONbits.GIE;
+    INTCONbits.GIE = 0;         //no half-cleared row while isr() latches
+    for(i = 0; i < 9*PRF_handlers; i += 3){
+        memory[PRF_table + i] = ((i % 9) == 3) ? 0xff : 0; //min starts at 0xffffff
+        memory[PRF_table + i + 1] = memory[PRF_table + i];
+        memory[PRF_table + i + 2] = memory[PRF_table + i];
+    }
+    profiler_isr_pending = 0;
+    INTCONbits.GIE = interrupts;
+}
+
+uint32_t Profiler_Now(void){
+    uint16_t overflows;
+    unsigned char high, low;
+    do{
+        overflows = profiler_overflows;
+        high = TMR1H;
+        low = TMR1L;
+    }while(high != TMR1H || overflows != profiler_overflows); //TMR1L rolled over or isr() counted an overflow meanwhile
+    if(PIR1bits.TMR1IF && high < 0x80){//overflow not counted yet (inside isr() or with interrupts off)
+        overflows++;
+    }
+    return ((uint32_t)overflows << 16) | ((uint16_t)high << 8) | low;
+}
+
+static uint32_t Profiler_Get(unsigned char index){
+    return ((uint32_t)memory[index] << 16) | ((uint16_t)memory[index + 1] << 8) | memory[index + 2];
+}
+
+static void Profiler_Set(unsigned char index, uint32_t value){
+    memory[index] = (value >> 16) & 0xff;
+    memory[index + 1] = (value >> 8) & 0xff;
+    memory[index + 2] = value & 0xff;
+}
+
+//Stores duration as last duration of the row, and updates min and max
+static void Profiler_Store(unsigned char row, uint32_t duration){
+    unsigned char index = PRF_table + 9*row;
+    if(duration > 0xffffff){
+        duration = 0xffffff;
+    }
+    Profiler_Set(index, duration);
+    if(duration < Profiler_Get(index + 3)){
+        Profiler_Set(index + 3, duration);
+    }
+    if(duration > Profiler_Get(index + 6)){
+        Profiler_Set(index + 6, duration);
+    }
+}
+
+//Stores the time since start in the row of a main loop handler
+void Profiler_Record(unsigned char row, uint32_t start){
+    Profiler_Store(row, Profiler_Now() - start);
+}
+
+//Called from the main loop: isr() only latches its 16-bit duration (Profile_Exit()), the bookkeeping is done here
+void Profiler_Isr(void){
+    if(profiler_isr_pending){
+        Profiler_Store(PRF_isr, profiler_isr_ticks);
+        profiler_isr_pending = 0;
+    }
+}
 
 void nvm_unlock(void){
     NVMCON2 = 0x55;
@@ -74,21 +190,6 @@ void flash_memory_erase(unsigned int address, unsigned char erase_config_registe
 }	
 
 
-void flash_memory_set_bootloader_flag(void){
-    flash_memory_erase(bootloader_flag, 1);//erase user ID register
-    __delay_ms(20);
-    
-    NVMCON1bits.WREN = 1; //allow writing
-    NVMCON1bits.NVMREGS = 0;
-    NVMCON1bits.LWLO = 0; //next write to latch will initiate write process to flash
-    NVMADRL = bootloader_flag_LSB; //set address
-    NVMADRH = bootloader_flag_MSB;
-    NVMDATL = 0; //write 1 to bootloader flag word to leave bootloader on reset, write 0 to stay in bootloader
-    NVMDATH = 0;
-    nvm_unlock(); //unlock sequence, this time also initiates write to flash
-    NVMCON1bits.WREN = 0; //inhibit writing
-}
-
 /*
  * 0x8000 (first User ID) contains the BL flag byte.
  * Useful overall for writing to program memory: http://ww1.microchip.com/downloads/en/DeviceDoc/40001738D.pdf
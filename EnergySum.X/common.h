@@ -5,18 +5,36 @@
 #include <stdint.h>
 
 #define reset_flag 0xbb
-#define bootloader_flag 0x8000 //User ID register
+#define bootloader_flag 0x8000 //User ID register, only read by the bootloader when there is no RAM handoff (cold boot)
 #define bootloader_flag_MSB 0x80
 #define bootloader_flag_LSB 0x00
+#define bootloader_handoff_address 0x20 //bank 0 RAM word kept across RESET; same definitions in Bootloader.X/flash.h
+#define bootloader_handoff_stay 0x5AA5 //bootloader stays active after the next RESET
+#define bootloader_handoff_leave 0xA55A //bootloader starts the application right away after the next RESET
+#define reset_counters_address 0x22 //bank 0 RAM bytes kept across RESET, counted by Counters_Init(); same definitions in Bootloader.X/flash.h
+#define reset_causes 6 //power-on, brown-out, MCLR, watchdog, RESET instruction, stack overflow/underflow
 
 #define baseline_ADC_value  0x024D //=589, ADC measured value when baseline is 0 TODO: this changes with temperature etc.?
 #define VOLATILE_DAC0_ADDRESS 0x00 
+#define BT_avg_shift 3 //2^BT_avg_shift ADC samples are averaged by Baseline_Measure()
 
 void ODAC_SetValue(uint16_t value);
 uint16_t SetBaseline(void);
+uint16_t Baseline_Measure(void);
+void Timebase_Init(void);
+unsigned char Timebase_Tick(void);
 void nvm_unlock(void);
 void flash_memory_erase (unsigned int address, unsigned char erase_config_registers);
-void flash_memory_set_bootloader_flag(void);
+void Profiler_Init(void);
+void Profiler_Clear(void);
+uint32_t Profiler_Now(void);
+void Profiler_Record(unsigned char row, uint32_t start);
+void Profiler_Isr(void);
+
+extern __persistent volatile unsigned int bootloader_handoff;
+extern volatile uint16_t profiler_overflows;
+extern volatile uint16_t profiler_isr_ticks;
+extern volatile unsigned char profiler_isr_pending;
 
 #endif
 
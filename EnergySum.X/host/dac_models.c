@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include <xc.h>
+#include "host.h"
+#include "dac_models.h"
+#include "../ODAC.h"
+
+/*
+ * See dac_models.h. MOSI enters MDAC 1; the SDO of MDAC n feeds MDAC n+1 and the SDO of the last MDAC drives MISO,
+ * so the first word of a frame ends up in the last MDAC (see MDAC_GetNumber()). Both devices latch at the rising chip select.
+ */
+
+#define MDAC_ChainBytes (2*daisy_chain_length)
+#define SDO_DISABLED 3
+
+mdac_chip_t mdac_chips[daisy_chain_length];
+uint16_t odac_registers[32];
+dac_traffic_t dac_traffic;
+const char *dac_last_error;
+
+static uint8_t chain[MDAC_ChainBytes];  //chain[0] is the first byte out of the last MDAC, chain[MDAC_ChainBytes - 1] the last byte in
+static bool mdac_selected, odac_selected;
+static uint16_t mdac_frame_bytes;
+static uint16_t mdac_edge_errors;       //bit n: MDAC n+1 sampled on the wrong edge during this frame
+static uint16_t odac_frame_bytes;
+static uint8_t odac_command[3];
+static bool odac_edge_error, odac_contended;
+static char error_text[80];
+
+static const uint16_t odac_writable[32] = {[VOL_DAC0_ADDRESS] = 0x0fff, [VREF_ADDRESS] = 0x0003, [0x09] = 0x0003, [GAIN_STATUS_ADDRESS] = 0x0100};
+
+static void error(const char *what, int number){
+    snprintf(error_text, sizeof(error_text), what, number);
+    dac_last_error = error_text;
+    dac_traffic.errors++;
+}
+
+/*
+ * AD5429: executes the 16-bit word in the shift register of one chip (control bits 21/28, data in DB11-DB4)
+ */
+static void mdac_execute(unsigned char n){
+    mdac_chip_t *chip = &mdac_chips[n];
+    uint8_t *shift = &chain[MDAC_ChainBytes - 2 - 2*n];
+    uint8_t control = shift[0] >> 4;
+    uint8_t data = (shift[0] << 4) | (shift[1] >> 4);
+    switch(control){
+        case 0b0000:
+        case 0b1111:
+            break;
+        case MDAC_WriteA:
+        case MDAC_WriteB:
+            chip->input[control == MDAC_WriteB] = data;
+            chip->dac[control == MDAC_WriteB] = data;
+            break;
+        case MDAC_ReadA:
+        case MDAC_ReadB:
+            shift[0] = chip->dac[control == MDAC_ReadB] >> 4; //shifted out with the next frame
+            shift[1] = chip->dac[control == MDAC_ReadB] << 4;
+            break;
+        case 0b0011:
+        case 0b0110:
+            chip->input[control == 0b0110] = data;
+            break;
+        case 0b0111:
+            chip->dac[0] = chip->input[0];
+            chip->dac[1] = chip->input[1];
+            break;
+        case 0b1000:
+            chip->input[0] = data;
+            chip->input[1] = data;
+            break;
+        case 0b1001:
+            chip->daisy_chain = false;
+            error("MDAC %d: daisy chain disabled", n + 1);
+            break;
+        case 0b1010:
+            chip->rising_edge = true;
+            break;
+        case 0b1011:
+        case 0b1100:
+            chip->dac[0] = chip->dac[1] = chip->input[0] = chip->input[1] = (control == 0b1100) ? 0x80 : 0;
+            break;
+        case MDAC_ControlWord:
+            if((data & 0b111) != 0 || (shift[1] & 0x0f) != 0){
+                error("MDAC %d: reserved control word bits set", n + 1);
+            }
+            chip->sdo = data >> 6;
+            chip->daisy_chain = (data >> 5) & 1;
+            chip->midscale_clear = (data >> 4) & 1;
+            chip->rising_edge = (data >> 3) & 1;
+            if(!chip->daisy_chain){
+                error("MDAC %d: daisy chain disabled", n + 1);
+            }
+            if(chip->sdo == SDO_DISABLED && n != daisy_chain_length - 1){
+                error("MDAC %d: SDO disabled inside the daisy chain", n + 1);
+            }
+            break;
+        default:
+            error("MDAC %d: reserved command", n + 1);
+    }
+}
+
+static void mdac_latch(void){
+    if(mdac_frame_bytes == 0){
+        return;
+    }
+    if(mdac_frame_bytes % 2 != 0){
+        error("MDAC frame of %d bytes, not whole 16-bit words", mdac_frame_bytes);
+        return;
+    }
+    if(mdac_frame_bytes < MDAC_ChainBytes){
+        error("MDAC frame of %d bytes, shorter than the daisy chain", mdac_frame_bytes);
+    }
+    for(unsigned char n = 0; n < daisy_chain_length; n++){
+        if(mdac_edge_errors & (1 << n)){
+            error("MDAC %d: clocked on the wrong edge", n + 1);
+        }
+        else{
+            mdac_execute(n);
+        }
+    }
+}
+
+static uint8_t mdac_exchange(uint8_t mosi, bool rising){
+    uint8_t miso = chain[0];
+    for(unsigned char n = 0; n < daisy_chain_length; n++){
+        if(mdac_chips[n].rising_edge != rising){
+            mdac_edge_errors |= 1 << n;
+        }
+    }
+    memmove(chain, chain + 1, MDAC_ChainBytes - 1);
+    chain[MDAC_ChainBytes - 1] = mosi;
+    dac_traffic.mdac_bytes++;
+    mdac_frame_bytes++;
+    return (mdac_chips[daisy_chain_length - 1].sdo == SDO_DISABLED) ? 0xff : miso;
+}
+
+/*
+ * MCP48FVB21: [A4-A0 C1 C0 CMDERR] [D15-D8] [D7-D0]; SDO is high except for CMDERR (low on an invalid command) and read data
+ */
+static bool odac_valid(uint8_t command){
+    uint8_t address = command >> 3;
+    uint8_t c = (command >> 1) & 0b11;
+    return (c == ODAC_WRITE_COMMAND || c == ODAC_READ_COMMAND) && odac_writable[address] != 0;
+}
+
+static void odac_execute(void){
+    uint8_t address = odac_command[0] >> 3;
+    uint16_t data = (odac_command[1] << 8) | odac_command[2];
+    if(!odac_valid(odac_command[0])){
+        error("MCP48FVB21: invalid command 0x%02x", odac_command[0]);
+        return;
+    }
+    if(((odac_command[0] >> 1) & 0b11) == ODAC_READ_COMMAND){
+        if(odac_contended){
+            error("MCP48FVB21: read while the last MDAC drives MISO", 0);
+        }
+        return;
+    }
+    if(data & ~odac_writable[address]){
+        error("MCP48FVB21: write to unimplemented bits of register 0x%02x", address);
+    }
+    odac_registers[address] = (odac_registers[address] & ~odac_writable[address]) | (data & odac_writable[address]);
+}
+
+static uint8_t odac_exchange(uint8_t mosi, bool rising){
+    uint8_t position = odac_frame_bytes % 3;
+    uint8_t miso = 0xff;
+    if(!rising){
+        odac_edge_error = true;
+    }
+    odac_command[position] = mosi;
+    if(position == 0){
+        miso = odac_valid(mosi) ? 0xff : 0xfe;
+    }
+    else if(odac_valid(odac_command[0]) && ((odac_command[0] >> 1) & 0b11) == ODAC_READ_COMMAND){
+        uint16_t value = odac_registers[odac_command[0] >> 3];
+        miso = (position == 1) ? (value >> 8) : (value & 0xff);
+    }
+    if(position == 2){
+        odac_execute();
+    }
+    dac_traffic.odac_bytes++;
+    odac_frame_bytes++;
+    return miso;
+}
+
+/*
+ * Hooks
+ */
+static void chip_select(uint8_t latc){
+    bool mdac = !(latc & 0b10);
+    bool odac = !(latc & 0b01);
+    if(mdac && odac && !(mdac_selected && odac_selected)){
+        error("both chip selects active", 0);
+    }
+    if(mdac && !mdac_selected){
+        dac_traffic.mdac_frames++;
+        mdac_frame_bytes = 0;
+        mdac_edge_errors = 0;
+    }
+    if(!mdac && mdac_selected){
+        mdac_latch();
+    }
+    if(odac && !odac_selected){
+        dac_traffic.odac_frames++;
+        odac_frame_bytes = 0;
+        odac_edge_error = false;
+        odac_contended = (mdac_chips[daisy_chain_length - 1].sdo != SDO_DISABLED);
+        if(odac_contended){
+            dac_traffic.contended_frames++;
+        }
+    }
+    if(!odac && odac_selected){
+        if(odac_frame_bytes % 3 != 0){
+            error("MCP48FVB21 frame of %d bytes, not whole 24-bit commands", odac_frame_bytes);
+        }
+        if(odac_edge_error){
+            error("MCP48FVB21: clocked on the falling edge", 0);
+        }
+    }
+    mdac_selected = mdac;
+    odac_selected = odac;
+}
+
+static uint8_t spi_exchange(uint8_t mosi){
+    bool rising = (SSP1STATbits.CKE != SSP1CON1bits.CKP); //data sampled by the slave on the rising SCK edge
+    if(mdac_selected && odac_selected){
+        return 0xff;
+    }
+    if(mdac_selected){
+        return mdac_exchange(mosi, rising);
+    }
+    if(odac_selected){
+        return odac_exchange(mosi, rising);
+    }
+    dac_traffic.unselected_bytes++;
+    return 0xff;
+}
+
+void dac_models_install(void){
+    memset(mdac_chips, 0, sizeof(mdac_chips));
+    for(unsigned char n = 0; n < daisy_chain_length; n++){
+        mdac_chips[n].daisy_chain = true; //power-on: daisy chain enabled, SDO full driver, falling edge, DACs at zero
+    }
+    memset(chain, 0, sizeof(chain));
+    memset(odac_registers, 0, sizeof(odac_registers));
+    odac_registers[VOL_DAC0_ADDRESS] = 0x7ff;   //POR value, 4/84
+    odac_registers[GAIN_STATUS_ADDRESS] = 0x0080; //POR bit
+    mdac_selected = false;
+    odac_selected = false;
+    memset(&dac_traffic, 0, sizeof(dac_traffic));
+    dac_last_error = 0;
+    host_hooks.spi_exchange = spi_exchange;
+    host_hooks.chip_select = chip_select;
+}
+
+void dac_models_clear(void){
+    host_sync();
+    memset(&dac_traffic, 0, sizeof(dac_traffic));
+    dac_last_error = 0;
+}
+
+uint8_t mdac_channel(unsigned char index){
+    return mdac_chips[(index - 1) / 2].dac[(index - 1) % 2];
+}
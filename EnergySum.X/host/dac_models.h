@@ -0,0 +1,43 @@
+#ifndef DAC_MODELS_HEADER
+#define	DAC_MODELS_HEADER
+
+/*
+ * Behavioural models of the two SPI devices on MSSP1, for the host build:
+ *  AD5429 daisy chain (CS_MDAC, LATC1): 16-bit shift register per chip, commands as in MDAC.c (AD5429 20-22/28)
+ *  MCP48FVB21 offset DAC (CS_DAC, LATC0): volatile register file, 24-bit commands (MCP48FVB21 32/84, 52/84)
+ * Every frame is checked (length, clock edge, command, SDO state); traffic is counted in bytes and chip select cycles.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../MDAC.h"
+
+typedef struct {
+    uint8_t dac[2];         //DAC registers A, B
+    uint8_t input[2];       //input registers A, B
+    uint8_t sdo;            //SDO2 SDO1 of the control word: 0 full, 1 weak, 2 open drain, 3 disabled
+    bool daisy_chain;       //DSY
+    bool midscale_clear;    //HCLR
+    bool rising_edge;       //SCLK
+} mdac_chip_t;
+
+typedef struct {
+    uint32_t mdac_bytes;
+    uint32_t mdac_frames;       //CS_MDAC cycles
+    uint32_t odac_bytes;
+    uint32_t odac_frames;       //CS_DAC cycles
+    uint32_t unselected_bytes;  //exchanged with no chip selected
+    uint32_t contended_frames;  //offset DAC frames while the last MDAC drives MISO
+    uint32_t errors;
+} dac_traffic_t;
+
+extern mdac_chip_t mdac_chips[daisy_chain_length];  //mdac_chips[0] is MDAC 1 (channels 1, 2), next to the PIC
+extern uint16_t odac_registers[32];                 //VOL_DAC0_ADDRESS, VREF_ADDRESS, 0x09 power-down, GAIN_STATUS_ADDRESS
+extern dac_traffic_t dac_traffic;
+extern const char *dac_last_error;
+
+void dac_models_install(void);  //power-on state of both devices, installs the SPI hooks (after host_reset())
+void dac_models_clear(void);    //ends the open frame (host_sync()), then clears dac_traffic and dac_last_error
+uint8_t mdac_channel(unsigned char index);          //DAC register of ESUM channel 1-24
+
+#endif
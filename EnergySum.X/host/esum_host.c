@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+#include "dac_models.h"
+#include "../main.h"
+
+/*
+ * Host run of the firmware: boots it, checks the register map over the simulated I2C bus and the SPI traffic of the DAC
+ * operations against the device models, then times the main loop handlers.
+ * Usage: ./esum_host [iterations per handler]
+ * "host ns" is the time on this machine, "firmware us" the simulated time on the PIC (delays, transfers, conversions).
+ */
+
+static int failures = 0;
+
+static void check(int condition, const char *what){
+    printf("%-48s %s\n", what, condition ? "ok" : "FAILED");
+    if(!condition){
+        failures++;
+    }
+}
+
+static void write_register(uint8_t reg, uint8_t value){
+    uint8_t data[2] = {reg, value};
+    host_i2c_write(memory[I2C_store], data, 2);
+}
+
+static uint8_t read_register(uint8_t reg){
+    uint8_t value = 0;
+    host_i2c_write(memory[I2C_store], &reg, 1);
+    host_i2c_read(memory[I2C_store], &value, 1);
+    return value;
+}
+
+static uint16_t counter(uint8_t reg){
+    return (memory[reg] << 8) | memory[reg + 1];
+}
+
+static void sanity_checks(void){
+    check(memory[version_register] == version_number, "version register after boot");
+    check(memory[0x1c] == 'M' && memory[0x6c] == 'B', "labels after boot");
+    uint8_t odac[3] = {ODAC_MSB, 0x03, 0x60};
+    check(host_i2c_write(i2c_default_address, odac, 3) == 0, "write to the default address");
+    check(read_register(ODAC_MSB) == 0x03 && read_register(ODAC_LSB) == 0x60, "auto-increment write, read back");
+    uint32_t start = host_state.time_us;
+    write_register(ADC_flag, 0b1);
+    host_main_loop();
+    check(memory[ADC_flag] == 0 && ((memory[ADC_MSB] << 8) | memory[ADC_MSB + 1]) == baseline_ADC_value, "ADC_flag: measurement stored, flag cleared");
+    check(host_state.time_us - start >= 1200000UL, "ADC_flag: takes the firmware delays");
+    write_register(UID_flag, 0b1);
+    host_main_loop();
+    check(memory[UID_store] == host_uid[0] && memory[UID_store + 5] == host_uid[5], "UID_flag: UID chip read over MSSP2 master");
+    check(read_register(version_register) == version_number, "slave answers again after the UID read");
+    write_register(reset_flag, 0x02);
+    host_main_loop();
+    check(host_state.resets == 1 && bootloader_handoff == bootloader_handoff_stay, "reset_flag 2: RESET with bootloader handoff");
+    memory[reset_flag] = 0;
+    check(memory[CNT_pcon] == 0b00111100 && memory[CNT_resets] == 1 && memory[0x7c] == 'C', "counters: power-on reset counted at boot");
+    reset_counters[0] = 3; reset_counters[2] = 7;
+    PCON0 = 0b00111110;
+    Counters_Init();
+    check(memory[CNT_resets] == 0 && memory[CNT_resets + 1] == 1 && memory[CNT_resets + 2] == 0, "counters: brown-out starts them from 0");
+    PCON0 = 0b00111100;
+    Counters_Init();
+    uint16_t isr_calls = counter(CNT_isr), rx = counter(CNT_rx), tx = counter(CNT_tx);
+    uint8_t data[4];
+    host_i2c_write(memory[I2C_store], odac, 3);
+    check(counter(CNT_isr) - isr_calls == 4 && counter(CNT_rx) - rx == 4, "counters: write transaction (4 bytes received)");
+    host_i2c_read(memory[I2C_store], data, 4);
+    check(counter(CNT_tx) - tx == 4 && counter(CNT_isr) - isr_calls == (counter(CNT_rx) - rx) + (counter(CNT_tx) - tx), "counters: read transaction (4 bytes sent)");
+    check(counter(CNT_loops) > 0 && counter(CNT_adc) == 1 && counter(CNT_misc) == 1, "counters: main loop and commands");
+    write_register(CNT_flag, 0b1);
+    host_main_loop();
+    int cleared = memory[CNT_flag] == 0 && memory[CNT_pcon] == 0b00111100;
+    for(uint8_t reg = CNT_isr; reg < CNT_resets + reset_causes; reg++){
+        if((reg < CNT_wcol + 2 || (reg >= CNT_spi && reg < CNT_misc + 2) || reg >= CNT_resets) && memory[reg] != 0){
+            cleared = 0;
+        }
+    }
+    check(cleared, "counters: CNT_flag clears them");
+}
+
+/*
+ * trace[]: read as one block from TRC_data, oldest entry first
+ */
+static void trace_checks(void){
+    uint8_t reg = TRC_data, block[trace_length];
+    write_register(TRC_flag, 0b1);
+    host_main_loop();
+    write_register(ADC_flag, 0b1);
+    host_main_loop();
+    host_i2c_write(memory[I2C_store], &reg, 1);
+    host_i2c_read(memory[I2C_store], block, trace_length);
+    uint8_t *clear = &block[trace_length - 12], *write = &block[trace_length - 8], *done = &block[trace_length - 4];
+    check(block[0] == 0xff && block[trace_length - 13] == 0xff && clear[0] == TRC_flag && clear[1] == 0 && (clear[2] & trace_done),
+          "trace: TRC_flag clears it, entries oldest first");
+    uint16_t write_time = ((write[2] & 0x7f) << 8) | write[3], done_time = ((done[2] & 0x7f) << 8) | done[3];
+    check(write[0] == ADC_flag && write[1] == 0b1 && !(write[2] & trace_done) && done[0] == ADC_flag && done[1] == 0 && (done[2] & trace_done),
+          "trace: host write and command completion");
+    check((uint16_t)(done_time - write_time) >= 1150 && (uint16_t)(done_time - write_time) <= 1170, "trace: time stamps span the 1.2 s measurement");
+    uint8_t again[4];
+    host_i2c_read(memory[I2C_store], again, 4);
+    check(again[0] == block[0] && again[3] == block[3], "trace: reading on wraps around the buffer");
+}
+
+/*
+ * General call and group address: own address 0x2e and group address 0x4f open the SSP2MSK window x0x111x, in which
+ * 0x0f belongs to another module
+ */
+static void group_checks(void){
+    uint8_t own = memory[I2C_store], mdac[3] = {2, 0x5a, 0x5b}, odac[3] = {ODAC_MSB, 0x02, 0x34}, reset[2] = {reset_flag, 0x01};
+    uint8_t apply[2] = {GRP_apply, 0b11}, other[2] = {4, 0x77}, value = 0;
+    uint8_t settings[3] = {GRP_flag, i2c_general_call_enable | i2c_group_enable, 0x4f};
+    check(host_i2c_write(0, apply, 2) != 0, "group: no general call by default");
+    host_i2c_write(own, settings, 3);
+    write_register(I2C_flag, 0b1);
+    host_main_loop();
+    memory[3] = 0;
+    host_i2c_write(0x4f, mdac, 3);
+    host_i2c_write(0x4f, reset, 2);
+    host_i2c_write(0x4f, odac, 3);
+    host_i2c_write(0x0f, other, 2);
+    check(memory[2] == 0x5a && memory[3] == 0x5b && memory[ODAC_MSB] == 0x02 && memory[ODAC_LSB] == 0x34, "group: writes reach the shadow configuration");
+    check(memory[reset_flag] == 0 && memory[4] != 0x77 && mdac_channel(3) != 0x5a, "group: other registers and addresses ignored");
+    host_i2c_read(0x0f, &value, 1);
+    check(value == 0xff && read_register(2) == 0x5a, "group: reads only answered at the own address");
+    uint8_t row[68] = {0x09, 0x00, 0x10}, before[256]; //bootloader row broadcast (CMD_WRITE_ROW, address, 64 data bytes, CRC)
+    for(unsigned char i = 3; i < sizeof(row); i++){
+        row[i] = i;
+    }
+    memcpy(before, memory, sizeof(before));
+    host_i2c_write(0, row, sizeof(row));
+    host_i2c_write(0, odac, 3);
+    int unchanged = 1;
+    for(unsigned int reg = 0; reg < sizeof(before); reg++){
+        if(memory[reg] != before[reg] && !(reg >= CNT_isr && reg < CNT_misc + 2)){ //the I2C counters count the bytes
+            unchanged = 0;
+        }
+    }
+    check(unchanged, "group: general call only writes GRP_apply");
+    dac_models_clear();
+    host_i2c_write(0, apply, 2);
+    host_main_loop();
+    host_sync();
+    check(mdac_channel(3) == 0x5a && mdac_channel(4) == 0x5b && odac_registers[VOL_DAC0_ADDRESS] == 0x234 && memory[GRP_apply] == 0,
+          "group: general call GRP_apply updates MDACs, ODAC");
+    check(dac_traffic.errors == 0, "group: SPI frames valid");
+    write_register(GRP_flag, 0);
+    write_register(I2C_flag, 0b1);
+    host_main_loop();
+    check(host_i2c_write(0x4f, apply, 2) != 0 && host_i2c_write(0, apply, 2) != 0, "group: GRP_flag 0 turns both off");
+}
+
+/*
+ * Tracking_Process() against a baseline set through the ADC hook: BT_interval 0 corrects on every call
+ */
+static uint16_t tracking_adc;
+static uint16_t tracking_adc_convert(uint8_t channel){
+    return tracking_adc;
+}
+
+static uint16_t tracking_step(uint16_t adc){//one correction; returns the tracked ODAC code (BT_code)
+    tracking_adc = adc;
+    Tracking_Process();
+    return counter(BT_code_MSB);
+}
+
+static void tracking_start(uint16_t code, uint8_t limit){//new reference code, correction back to 0
+    memory[BT_flag] = 0;
+    Tracking_Process();
+    memory[ODAC_MSB] = code >> 8;
+    memory[ODAC_LSB] = code & 0xff;
+    memory[ODAC_flag] = 0b01;
+    SPI_Process();
+    memory[BT_limit] = limit;
+    memory[BT_flag] = 0b1;
+    Tracking_Process();
+}
+
+static void tracking_checks(void){
+    uint16_t (*adc_convert)(uint8_t) = host_hooks.adc_convert;
+    host_hooks.adc_convert = tracking_adc_convert;
+    memory[BT_deadband] = 4;
+    memory[BT_step] = 3;
+    memory[BT_interval] = 0;
+    tracking_start(0x800, 0);
+    check(tracking_step(baseline_ADC_value + 4) == 0x800 && tracking_step(baseline_ADC_value - 4) == 0x800 && counter(BT_corr_MSB) == 0,
+          "tracking: no correction inside the deadband");
+    check(tracking_step(baseline_ADC_value + 5) == 0x803 && tracking_step(baseline_ADC_value + 40) == 0x806 && counter(BT_corr_MSB) == 6,
+          "tracking: low baseline (high ADC) raises code");
+    host_sync();
+    check(odac_registers[VOL_DAC0_ADDRESS] == 0x806 && counter(BT_avg_MSB) == baseline_ADC_value + 40, "tracking: ODAC written, average stored");
+    check(tracking_step(baseline_ADC_value - 5) == 0x803 && tracking_step(baseline_ADC_value - 40) == 0x800 && tracking_step(0) == 0x7fd
+          && counter(BT_corr_MSB) == 0xfffd, "tracking: high baseline lowers code, BT_corr < 0");
+    memory[ODAC_MSB] = 0x01; //pending host or group value, not applied yet
+    memory[ODAC_LSB] = 0x23;
+    check(tracking_step(0) == 0x7fa && memory[ODAC_MSB] == 0x01 && memory[ODAC_LSB] == 0x23, "tracking: pending ODAC_MSB/LSB left alone");
+    memory[ODAC_flag] = 0b01;
+    SPI_Process();
+    check(tracking_step(baseline_ADC_value + 5) == 0x123 && tracking_step(baseline_ADC_value + 5) == 0x126 && counter(BT_corr_MSB) == 3, "tracking: continues from applied ODAC value");
+    tracking_start(0x800, 5);
+    check(tracking_step(0x3ff) == 0x803 && tracking_step(0x3ff) == 0x805 && tracking_step(0x3ff) == 0x805 && counter(BT_corr_MSB) == 5,
+          "tracking: stops at +BT_limit");
+    check(tracking_step(0) == 0x802 && tracking_step(0) == 0x7ff && tracking_step(0) == 0x7fc && tracking_step(0) == 0x7fb
+          && tracking_step(0) == 0x7fb && counter(BT_corr_MSB) == 0xfffb, "tracking: stops at -BT_limit");
+    tracking_start(0xffe, 0);
+    check(tracking_step(0x3ff) == 0xfff && tracking_step(0x3ff) == 0xfff && counter(BT_corr_MSB) == 1, "tracking: stops at 0xfff");
+    tracking_start(0x001, 0);
+    check(tracking_step(0) == 0 && tracking_step(0) == 0 && counter(BT_corr_MSB) == 0xffff, "tracking: stops at 0");
+    memory[BT_flag] = 0;
+    Tracking_Process();
+    host_hooks.adc_convert = adc_convert;
+}
+
+/*
+ * SPI cost of the DAC operations in SPI_Process(), counted by the device models. The expected numbers are what the
+ * firmware sends today; an operation that needs more chip select cycles or bytes fails here.
+ */
+typedef struct {
+    const char *name;
+    void (*setup)(void);    //flags and data for SPI_Process()
+    int (*verify)(void);    //device or memory[] state afterwards
+    uint32_t mdac_frames, mdac_bytes, odac_frames, odac_bytes;
+} spi_operation_t;
+
+static void spi_setup_write_all(void){
+    for(unsigned char i = 0; i < 2*daisy_chain_length; i++){
+        memory[MDAC_1 + i] = 0x10 + i;
+    }
+    memory[MDAC_flag] = 0b010;
+}
+static int spi_verify_write_all(void){
+    for(unsigned char i = 0; i < 2*daisy_chain_length; i++){
+        if(mdac_channel(i + 1) != memory[MDAC_1 + i]){
+            return 0;
+        }
+    }
+    return 1;
+}
+static void spi_setup_write_single(void){ memory[4] = 0xa5; memory[MDAC_flag] = (5 << 3) | 0b001; }
+static int spi_verify_write_single(void){ return mdac_channel(5) == 0xa5 && mdac_channel(4) == memory[3]; }
+static void spi_setup_read_all(void){
+    for(unsigned char i = 0; i < 2*daisy_chain_length; i++){
+        mdac_chips[i / 2].dac[i % 2] = 0x40 + i;
+        memory[MDAC_1 + i] = 0;
+    }
+    memory[MDAC_flag] = 0b100;
+}
+static int spi_verify_read_all(void){
+    for(unsigned char i = 0; i < 2*daisy_chain_length; i++){
+        if(memory[MDAC_1 + i] != 0x40 + i){
+            return 0;
+        }
+    }
+    return 1;
+}
+static void spi_setup_odac_write(void){ memory[ODAC_MSB] = 0x03; memory[ODAC_LSB] = 0x21; memory[ODAC_flag] = 0b01; }
+static int spi_verify_odac_write(void){ return odac_registers[VOL_DAC0_ADDRESS] == 0x321 && mdac_chips[daisy_chain_length - 1].sdo == 0; }
+static void spi_setup_odac_read(void){ odac_registers[VOL_DAC0_ADDRESS] = 0x456; memory[ODAC_flag] = 0b10; }
+static int spi_verify_odac_read(void){ return memory[ODAC_MSB] == 0x04 && memory[ODAC_LSB] == 0x56; }
+
+static const spi_operation_t spi_operations[] = {
+    {"MDAC_LoadUpdate", spi_setup_write_all, spi_verify_write_all, 2, 4*daisy_chain_length, 0, 0},
+    {"MDAC_LoadUpdateSingle", spi_setup_write_single, spi_verify_write_single, 1, 2*daisy_chain_length, 0, 0},
+    {"MDAC_Read", spi_setup_read_all, spi_verify_read_all, 3, 6*daisy_chain_length, 0, 0},
+    {"SPI_Process: ODAC write", spi_setup_odac_write, spi_verify_odac_write, 2, 4*daisy_chain_length, 1, 3}, //MDAC SDO off and on again
+    {"SPI_Process: ODAC read", spi_setup_odac_read, spi_verify_odac_read, 2, 4*daisy_chain_length, 1, 3},
+};
+
+static void spi_traffic_checks(void){
+    printf("\n%-28s %16s %16s\n", "SPI operation", "MDAC cs/bytes", "ODAC cs/bytes");
+    for(unsigned int o = 0; o < sizeof(spi_operations)/sizeof(spi_operations[0]); o++){
+        const spi_operation_t *op = &spi_operations[o];
+        char what[64];
+        op->setup();
+        dac_models_clear();
+        SPI_Process();
+        host_sync();
+        printf("%-28s %9lu/%-6lu %9lu/%-6lu\n", op->name, (unsigned long)dac_traffic.mdac_frames, (unsigned long)dac_traffic.mdac_bytes,
+               (unsigned long)dac_traffic.odac_frames, (unsigned long)dac_traffic.odac_bytes);
+        snprintf(what, sizeof(what), "%s: traffic as expected", op->name);
+        check(dac_traffic.mdac_frames == op->mdac_frames && dac_traffic.mdac_bytes == op->mdac_bytes
+              && dac_traffic.odac_frames == op->odac_frames && dac_traffic.odac_bytes == op->odac_bytes, what);
+        snprintf(what, sizeof(what), "%s: frames valid", op->name);
+        check(dac_traffic.errors == 0 && dac_traffic.unselected_bytes == 0, what);
+        if(dac_last_error != 0){
+            printf("    %s\n", dac_last_error);
+        }
+        snprintf(what, sizeof(what), "%s: device state", op->name);
+        check(op->verify(), what);
+    }
+}
+
+#if profiler_enabled
+static uint32_t profiler_value(uint8_t row, uint8_t column){//column 0: last, 1: min, 2: max
+    uint8_t index = PRF_table + 9*row + 3*column;
+    return ((uint32_t)memory[index] << 16) | (memory[index + 1] << 8) | memory[index + 2];
+}
+
+static void profiler_checks(void){
+    write_register(PRF_flag, 0b1);
+    host_main_loop();
+    check(memory[PRF_flag] == 0 && profiler_value(PRF_adc, 1) == 0xffffff && profiler_value(PRF_adc, 2) == 0, "profiler: PRF_flag clears the table");
+    write_register(ADC_flag, 0b1);
+    host_main_loop();
+    uint32_t adc = profiler_value(PRF_adc, 0);
+    check(adc >= 1200000UL*8 && adc < 1201000UL*8 && profiler_value(PRF_adc, 2) == adc, "profiler: ADC_Process, 1.2 s over Timer1 overflows");
+    check(profiler_value(PRF_isr, 1) != 0xffffff && profiler_value(PRF_spi, 1) == 0, "profiler: isr() and idle handlers recorded");
+}
+#endif
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);    //before each call, not timed
+    void (*run)(void);
+} bench_t;
+
+static void setup_none(void){}
+static void setup_mdac_all(void){ memory[MDAC_flag] = 0b010; }
+static void setup_mdac_single(void){ memory[MDAC_flag] = (5 << 3) | 0b001; }
+static void setup_mdac_read(void){ memory[MDAC_flag] = 0b100; }
+static void setup_odac(void){ memory[ODAC_flag] = 0b01; }
+static void setup_adc(void){ memory[ADC_flag] = 0b1; }
+static void setup_baseline(void){ memory[BL_flag] = 0b1; }
+static void setup_tracking(void){ memory[BT_flag] = 0b1; memory[BT_interval] = 0; }
+static void run_isr_write(void){
+    uint8_t data[3] = {ODAC_MSB, 0x03, 0x60};
+    host_i2c_write(memory[I2C_store], data, 3);
+}
+static void run_isr_read(void){
+    uint8_t data[4];
+    host_i2c_read(memory[I2C_store], data, 4);
+}
+static void run_tracking(void){
+    Tracking_Process();
+    Tracking_Process(); //first call only captures the reference
+    memory[BT_flag] = 0;
+    Tracking_Process();
+}
+
+static const bench_t benches[] = {
+    {"main loop, no flags", setup_none, host_main_loop},
+    {"isr: write transaction (3 bytes)", setup_none, run_isr_write},
+    {"isr: read transaction (4 bytes)", setup_none, run_isr_read},
+    {"SPI_Process: MDAC write all", setup_mdac_all, SPI_Process},
+    {"SPI_Process: MDAC write single", setup_mdac_single, SPI_Process},
+    {"SPI_Process: MDAC read all", setup_mdac_read, SPI_Process},
+    {"SPI_Process: ODAC write", setup_odac, SPI_Process},
+    {"ADC_Process: measurement", setup_adc, ADC_Process},
+    {"ADC_Process: SetBaseline", setup_baseline, ADC_Process},
+    {"Tracking_Process: one correction", setup_tracking, run_tracking},
+};
+
+static double now_ns(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static void run_benches(unsigned long iterations){
+    printf("\n%-36s %12s %14s\n", "handler", "host ns", "firmware us");
+    for(unsigned int b = 0; b < sizeof(benches)/sizeof(benches[0]); b++){
+        double host_ns = 0;
+        double firmware_us = 0;
+        for(unsigned long i = 0; i < iterations; i++){
+            benches[b].setup();
+            uint32_t start_us = host_state.time_us;
+            double start_ns = now_ns();
+            benches[b].run();
+            host_ns += now_ns() - start_ns;
+            firmware_us += (uint32_t)(host_state.time_us - start_us);
+        }
+        printf("%-36s %12.0f %14.0f\n", benches[b].name, host_ns/iterations, firmware_us/iterations);
+    }
+}
+
+int main(int argc, char **argv){
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], 0, 0) : 1000;
+    host_reset();
+    dac_models_install();
+    host_boot();
+    host_sync();
+    printf("boot: %lu MDAC, %lu ODAC frames (%lu while the last MDAC drives MISO), %lu bytes with no chip selected\n",
+           (unsigned long)dac_traffic.mdac_frames, (unsigned long)dac_traffic.odac_frames,
+           (unsigned long)dac_traffic.contended_frames, (unsigned long)dac_traffic.unselected_bytes);
+    check(dac_traffic.errors == 0, "boot: SPI frames valid");
+    sanity_checks();
+    trace_checks();
+    group_checks();
+    tracking_checks();
+#if profiler_enabled
+    profiler_checks();
+#endif
+    spi_traffic_checks();
+    run_benches(iterations);
+    return failures ? 1 : 0;
+}
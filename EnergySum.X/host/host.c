@@ -0,0 +1,543 @@
+#include <setjmp.h>
+#include <string.h>
+#include <xc.h>
+#include "host.h"
+#include "../main.h"
+
+/*
+ * SFR storage and peripheral models of the host build, see xc.h and host.h.
+ * Data sheet pages as in the firmware: MSSP 313/491, I2C slave 327/491, ADC 241/491, NVM 127/491, Timer2/4/6 192/491.
+ */
+
+#undef SSP1IF //host.c works on the storage of hooked registers directly
+#undef TMR4IF
+#undef SSP2IF
+
+void esum_main(void); //main() of ESUM.c, renamed by the Makefile
+
+volatile INTCONbits_t INTCONbits;
+volatile PIE1bits_t PIE1bits;
+volatile PIE2bits_t PIE2bits;
+volatile PCON0bits_t PCON0bits;
+volatile SSP1STATbits_t SSP1STATbits;
+volatile SSP1CON1bits_t SSP1CON1bits;
+volatile SSP2STATbits_t SSP2STATbits;
+volatile SSP2CON1bits_t SSP2CON1bits;
+volatile SSP2CON3bits_t SSP2CON3bits;
+volatile ADCON1bits_t ADCON1bits;
+volatile FVRCONbits_t FVRCONbits;
+volatile T0CON0bits_t T0CON0bits;
+volatile T0CON1bits_t T0CON1bits;
+volatile T1CONbits_t T1CONbits;
+volatile T4CONbits_t T4CONbits;
+volatile T6CONbits_t T6CONbits;
+volatile PMD0bits_t PMD0bits;
+volatile PMD4bits_t PMD4bits;
+volatile ANSELAbits_t ANSELAbits;
+volatile ANSELBbits_t ANSELBbits;
+volatile ANSELCbits_t ANSELCbits;
+volatile TRISAbits_t TRISAbits;
+volatile TRISBbits_t TRISBbits;
+volatile TRISCbits_t TRISCbits;
+volatile LATAbits_t LATAbits;
+volatile LATBbits_t LATBbits;
+volatile uint8_t SSP1ADD, SSP2ADD, SSP2MSK, PPSLOCK, RC2PPS, RC3PPS, RC5PPS, RC6PPS, SSP1DATPPS, SSP2DATPPS, SSP2CLKPPS;
+volatile uint8_t ADRESH, ADRESL, NVMADRL, NVMADRH, NVMDATL, NVMDATH, PR4, PR6, TMR4, TMR6, STATUS;
+
+volatile PIR1bits_t PIR1_reg;
+volatile PIR2bits_t PIR2_reg;
+volatile SSP2CON2bits_t SSP2CON2_reg;
+volatile ADCON0bits_t ADCON0_reg;
+volatile NVMCON1bits_t NVMCON1_reg;
+volatile LATCbits_t LATC_reg;
+static volatile uint8_t ssp1buf, ssp2buf, nvmcon2, tmr1h, tmr1l, tmr0h, tmr0l;
+
+host_hooks_t host_hooks;
+host_state_t host_state;
+uint16_t host_flash[0x2000];
+uint16_t host_user_id[4];
+uint8_t host_uid[6] = {0x00, 0x04, 0xA3, 0x12, 0x34, 0x56};
+
+static bool ssp1_touched;       //SSP1BUF written since the last SPI transfer
+static bool ssp2_touched;       //SSP2BUF accessed since the last master mode event
+static bool master_writing;     //master mode: after (repeated) start or a written byte, the next SSP2BUF access is a write
+static uint8_t nvm_unlock_step; //1: NVMCON2 held 0x55 at its last access
+static bool nvm_unlocked;       //the last NVMCON1 access came right after the unlock sequence
+static uint16_t nvm_latches[32];
+static uint8_t latc_seen;        //LATC as last reported to the chip_select hook
+static uint32_t tmr4_next_us, tmr6_next_us;
+static uint32_t tmr1;            //Timer1 counts, the upper 16 bits count overflows
+static bool in_idle, in_isr, booting;
+static jmp_buf boot_exit;
+
+static void nvm_sync(void);
+
+/*
+ * Default models: SPI reads back 0, the ADC sits at the nominal baseline, the UID chip (24AA025E48) answers with host_uid
+ */
+static uint8_t uid_pointer, uid_state;
+static uint8_t default_spi_exchange(uint8_t mosi){
+    return 0;
+}
+static uint16_t default_adc_convert(uint8_t channel){
+    return 0x024D;
+}
+static void default_i2c_master_start(void){
+    uid_state = 0;
+}
+static bool default_i2c_master_write(uint8_t data){
+    if(uid_state == 0){//control byte
+        if((data & 0xfe) != 0b10100010){
+            return false;
+        }
+        uid_state = (data & 1) ? 2 : 1;
+        return true;
+    }
+    if(uid_state == 1){//word address
+        uid_pointer = data;
+        uid_state = 3;
+    }
+    return true;
+}
+static uint8_t default_i2c_master_read(void){
+    uint8_t value = 0xff;
+    if(uid_pointer >= 0xFA){
+        value = host_uid[uid_pointer - 0xFA];
+    }
+    uid_pointer++;
+    return value;
+}
+static void default_i2c_master_stop(void){
+    uid_state = 0;
+}
+
+/*
+ * Time and timers
+ */
+static uint32_t timer_period_us(uint8_t ckps, uint8_t outps, uint8_t pr){//Fosc/4 = 8 MHz, prescaler 1:1, 1:4, 1:16, 1:64
+    uint32_t ticks = (uint32_t)(pr + 1) * (1UL << (2*ckps)) * (outps + 1);
+    return ticks / 8;
+}
+static void update_timers(void){
+    if(T4CONbits.TMR4ON && (int32_t)(host_state.time_us - tmr4_next_us) >= 0){
+        PIR2_reg.TMR4IF = 1;
+        tmr4_next_us = host_state.time_us + timer_period_us(T4CONbits.T4CKPS, T4CONbits.T4OUTPS, PR4);
+    }
+    if(!T4CONbits.TMR4ON){
+        tmr4_next_us = host_state.time_us + timer_period_us(T4CONbits.T4CKPS, T4CONbits.T4OUTPS, PR4);
+    }
+    if(T6CONbits.TMR6ON && (int32_t)(host_state.time_us - tmr6_next_us) >= 0){
+        PIR2_reg.TMR6IF = 1;
+        tmr6_next_us = host_state.time_us + timer_period_us(T6CONbits.T6CKPS, T6CONbits.T6OUTPS, PR6);
+    }
+    if(!T6CONbits.TMR6ON){
+        tmr6_next_us = host_state.time_us + timer_period_us(T6CONbits.T6CKPS, T6CONbits.T6OUTPS, PR6);
+    }
+}
+
+/*
+ * Timer1 (profiler): Fosc/4 with prescaler only. Time advances in steps up to each overflow, so that the overflow
+ * interrupt runs as often as on the PIC.
+ */
+static bool timer1_running(void){
+    return T1CONbits.TMR1ON && T1CONbits.TMR1CS == 0;
+}
+static uint32_t timer1_counts_per_us(void){
+    return 8 >> T1CONbits.T1CKPS;
+}
+static void timer1_interrupt(void){
+    if(PIR1_reg.TMR1IF && PIE1bits.TMR1IE && INTCONbits.GIE && INTCONbits.PEIE && !in_isr){
+        in_isr = true;
+        host_state.isr_calls++;
+        isr();
+        in_isr = false;
+    }
+}
+
+volatile uint8_t *host_TMR1H(void){
+    tmr1h = (tmr1 >> 8) & 0xff;
+    return &tmr1h;
+}
+
+volatile uint8_t *host_TMR1L(void){
+    tmr1l = tmr1 & 0xff;
+    return &tmr1l;
+}
+
+/*
+ * Timer0 (trace time stamps): 16-bit, LFINTOSC (31 kHz) with prescaler 2^T0CKPS only; counts from firmware time
+ */
+volatile uint8_t *host_TMR0L(void){
+    uint32_t counts = 0;
+    if(T0CON0bits.T0EN && T0CON0bits.T016BIT && T0CON1bits.T0CS == 0b100){
+        counts = (uint32_t)((uint64_t)host_state.time_us * 31 / 1000 >> T0CON1bits.T0CKPS);
+    }
+    tmr0l = counts & 0xff;
+    tmr0h = (counts >> 8) & 0xff;
+    return &tmr0l;
+}
+
+volatile uint8_t *host_TMR0H(void){
+    return &tmr0h;
+}
+
+void host_advance_us(uint32_t us){
+    nvm_sync();
+    while(us > 0){
+        uint32_t step = us;
+        if(timer1_running()){
+            uint32_t to_overflow = (0x10000 - (tmr1 & 0xffff) + timer1_counts_per_us() - 1) / timer1_counts_per_us();
+            if(step > to_overflow){
+                step = to_overflow;
+            }
+            uint32_t before = tmr1;
+            tmr1 += step * timer1_counts_per_us();
+            if((before ^ tmr1) & 0xffff0000){
+                PIR1_reg.TMR1IF = 1;
+            }
+        }
+        host_state.time_us += step;
+        us -= step;
+        update_timers();
+        timer1_interrupt();
+        if(host_hooks.idle != 0 && !in_idle && !in_isr){
+            in_idle = true;
+            host_hooks.idle(host_state.time_us);
+            in_idle = false;
+        }
+    }
+}
+
+void host_delay_us(uint32_t us){
+    host_advance_us(us);
+}
+
+void host_asm(const char *instruction){
+    if(strcmp(instruction, "RESET") == 0){
+        host_state.resets++;
+        PCON0bits.nRI = 0;
+    }
+    else if(strcmp(instruction, "CLRWDT") == 0){
+        host_state.clrwdt++;
+        if(booting){//main() has reached its main loop
+            longjmp(boot_exit, 1);
+        }
+    }
+}
+
+/*
+ * NVM: unlock sequence, then WR starts the operation; it is done at the next NVMCON1 access or when time passes (the CPU stalls meanwhile)
+ */
+static void nvm_operation(void){
+    uint16_t address = ((uint16_t)NVMADRH << 8) | NVMADRL;
+    uint16_t *word = 0;
+    if(NVMCON1_reg.NVMREGS){
+        word = ((address & 0x7fff) < 4) ? &host_user_id[address & 0x3] : 0;
+    }
+    else{
+        word = &host_flash[address & 0x1fff];
+    }
+    host_state.nvm_writes++;
+    if(!NVMCON1_reg.WREN || word == 0){
+        NVMCON1_reg.WRERR = 1;
+    }
+    else if(NVMCON1_reg.FREE){//erase the row
+        uint16_t *row = NVMCON1_reg.NVMREGS ? host_user_id : &host_flash[address & 0x1fe0];
+        for(unsigned char i = 0; i < (NVMCON1_reg.NVMREGS ? 4 : 32); i++){
+            row[i] = 0x3fff;
+        }
+        host_advance_us(2000);
+    }
+    else{//load the latch; without LWLO, program all latches of the row
+        nvm_latches[address & 0x1f] = (((uint16_t)NVMDATH << 8) | NVMDATL) & 0x3fff;
+        if(!NVMCON1_reg.LWLO){
+            if(NVMCON1_reg.NVMREGS){
+                *word &= nvm_latches[address & 0x1f];
+            }
+            else{
+                for(unsigned char i = 0; i < 32; i++){
+                    host_flash[(address & 0x1fe0) + i] &= nvm_latches[i];
+                    nvm_latches[i] = 0x3fff;
+                }
+            }
+            host_advance_us(2000);
+        }
+    }
+}
+
+static void nvm_sync(void){//operation started by the last write to NVMCON1
+    if(NVMCON1_reg.WR){
+        bool unlocked = nvm_unlocked;
+        NVMCON1_reg.WR = 0; //WR can only be set right after the unlock sequence
+        nvm_unlocked = false;
+        if(unlocked){
+            nvm_operation();
+        }
+    }
+}
+
+volatile uint8_t *host_NVMCON2(void){//the value seen here is the one written by the previous access
+    nvm_unlock_step = (nvmcon2 == 0x55) ? 1 : 0;
+    return &nvmcon2;
+}
+
+volatile NVMCON1bits_t *host_NVMCON1(void){
+    nvm_sync();
+    if(NVMCON1_reg.RD){
+        uint16_t address = ((uint16_t)NVMADRH << 8) | NVMADRL;
+        uint16_t word = NVMCON1_reg.NVMREGS ? (((address & 0x7fff) < 4) ? host_user_id[address & 0x3] : 0x3fff) : host_flash[address & 0x1fff];
+        NVMDATL = word & 0xff;
+        NVMDATH = word >> 8;
+        NVMCON1_reg.RD = 0;
+    }
+    nvm_unlocked = (nvm_unlock_step == 1 && nvmcon2 == 0xaa); //0x55, 0xAA, then this access (sets WR)
+    nvm_unlock_step = 0;
+    return &NVMCON1_reg;
+}
+
+/*
+ * LATC: RC0/RC1 are the SPI chip selects. The accessor runs before the firmware's access, so a change is reported at the
+ * next LATC access or SPI byte; host_sync() reports the last one.
+ */
+void host_sync(void){
+    if(LATC_reg.byte != latc_seen){
+        latc_seen = LATC_reg.byte;
+        if(host_hooks.chip_select != 0){
+            host_hooks.chip_select(latc_seen);
+        }
+    }
+}
+
+volatile LATCbits_t *host_LATC(void){
+    host_sync();
+    return &LATC_reg;
+}
+
+/*
+ * MSSP1 (SPI master): a byte written to SSP1BUF is exchanged when the firmware waits for SSP1IF
+ */
+volatile uint8_t *host_SSP1BUF(void){
+    ssp1_touched = !PIR1_reg.SSP1IF; //with SSP1IF set, the firmware reads the received byte
+    return &ssp1buf;
+}
+
+volatile PIR1bits_t *host_PIR1(void){
+    if(!PIR1_reg.SSP1IF && ssp1_touched && SSP1CON1bits.SSPEN){
+        ssp1_touched = false;
+        host_sync();
+        ssp1buf = host_hooks.spi_exchange(ssp1buf);
+        host_state.spi_bytes++;
+        PIR1_reg.SSP1IF = 1;
+        host_advance_us(1);
+    }
+    return &PIR1_reg;
+}
+
+/*
+ * MSSP2 in master mode (SSPM = 1000, UID chip): start, stop, acknowledge and receive are done on the next wait for SSP2IF
+ */
+static void master_event(void){
+    if(SSP2CON2_reg.SEN){
+        SSP2CON2_reg.SEN = 0;
+        host_hooks.i2c_master_start();
+        master_writing = true;
+    }
+    else if(SSP2CON2_reg.RSEN){
+        SSP2CON2_reg.RSEN = 0;
+        host_hooks.i2c_master_start();
+        master_writing = true;
+    }
+    else if(SSP2CON2_reg.PEN){
+        SSP2CON2_reg.PEN = 0;
+        host_hooks.i2c_master_stop();
+        master_writing = false;
+    }
+    else if(SSP2CON2_reg.RCEN){
+        SSP2CON2_reg.RCEN = 0;
+        ssp2buf = host_hooks.i2c_master_read();
+        SSP2STATbits.BF = 1;
+        master_writing = false;
+        host_advance_us(290); //9 clocks at Fosc/((SSP2ADD + 1)*4) = 31 kHz
+    }
+    else if(SSP2CON2_reg.ACKEN){
+        SSP2CON2_reg.ACKEN = 0;
+    }
+    else if(ssp2_touched && master_writing){
+        SSP2CON2_reg.ACKSTAT = host_hooks.i2c_master_write(ssp2buf) ? 0 : 1;
+        host_advance_us(290);
+    }
+    else{
+        return;
+    }
+    ssp2_touched = false;
+    PIR2_reg.SSP2IF = 1;
+}
+
+static bool master_mode(void){
+    return SSP2CON1bits.SSPEN && SSP2CON1bits.SSPM == 0b1000;
+}
+
+volatile uint8_t *host_SSP2BUF(void){
+    ssp2_touched = true;
+    return &ssp2buf;
+}
+
+volatile SSP2CON2bits_t *host_SSP2CON2(void){
+    if(master_mode() && !PIR2_reg.SSP2IF){
+        master_event();
+    }
+    return &SSP2CON2_reg;
+}
+
+volatile PIR2bits_t *host_PIR2(void){
+    update_timers();
+    if(master_mode() && !PIR2_reg.SSP2IF){
+        master_event();
+    }
+    if(T6CONbits.TMR6ON && !PIR2_reg.TMR6IF && !in_isr){//firmware waits for Timer6 (testpulser)
+        host_advance_us(tmr6_next_us - host_state.time_us);
+    }
+    return &PIR2_reg;
+}
+
+/*
+ * ADC: the conversion runs when the firmware waits for GO to clear
+ */
+volatile ADCON0bits_t *host_ADCON0(void){
+    if(ADCON0_reg.GO && ADCON0_reg.ADON){
+        uint16_t result = host_hooks.adc_convert(ADCON0_reg.CHS) & 0x3ff;
+        if(ADCON1bits.ADFM){//right justified
+            ADRESH = result >> 8;
+            ADRESL = result & 0xff;
+        }
+        else{
+            ADRESH = result >> 2;
+            ADRESL = (result & 0b11) << 6;
+        }
+        ADCON0_reg.GO = 0;
+        host_state.adc_conversions++;
+        host_advance_us(12); //11.5 TAD with ADCRC
+    }
+    return &ADCON0_reg;
+}
+
+/*
+ * MSSP2 in I2C slave mode: the host is the bus master. Every byte raises SSP2IF and calls isr() if the interrupt is enabled.
+ */
+static void slave_interrupt(void){
+    SSP2STATbits.BF = 1;
+    PIR2_reg.SSP2IF = 1;
+    if(INTCONbits.GIE && INTCONbits.PEIE && PIE2bits.SSP2IE){
+        in_isr = true;
+        host_state.isr_calls++;
+        isr();
+        in_isr = false;
+    }
+    SSP2STATbits.BF = 0;
+}
+
+static bool slave_address_match(uint8_t address_byte){//7-bit addressing with SSP2MSK (bits 7-1), general call with GCEN
+    if(!SSP2CON1bits.SSPEN || master_mode()){
+        return false;
+    }
+    if((address_byte & 0xfe) == 0 && SSP2CON2_reg.GCEN){
+        return true;
+    }
+    return ((address_byte ^ SSP2ADD) & SSP2MSK & 0xfe) == 0;
+}
+
+static void slave_start(uint8_t address_byte){
+    SSP2STATbits.S = 1;
+    SSP2STATbits.P = 0;
+    SSP2STATbits.D_nA = 0;
+    SSP2STATbits.R_nW = address_byte & 1;
+    ssp2buf = address_byte;
+    slave_interrupt();
+}
+
+static void slave_stop(void){
+    SSP2STATbits.S = 0;
+    SSP2STATbits.P = 1;
+    SSP2STATbits.R_nW = 0;
+}
+
+int host_i2c_write(uint8_t address, const uint8_t *data, uint8_t length){
+    uint8_t address_byte = address << 1;
+    host_advance_us(10*(1 + length)); //400 kHz
+    if(!slave_address_match(address_byte)){
+        return -1;
+    }
+    slave_start(address_byte);
+    for(uint8_t i = 0; i < length; i++){
+        SSP2STATbits.D_nA = 1;
+        ssp2buf = data[i];
+        slave_interrupt();
+    }
+    slave_stop();
+    return 0;
+}
+
+int host_i2c_read(uint8_t address, uint8_t *data, uint8_t length){
+    uint8_t address_byte = (address << 1) | 1;
+    host_advance_us(10*(1 + length));
+    if(!slave_address_match(address_byte)){
+        return -1;
+    }
+    slave_start(address_byte); //the firmware loads the first byte into SSP2BUF
+    for(uint8_t i = 0; i < length; i++){
+        data[i] = ssp2buf;
+        if(i + 1 < length){//ACK from the master: next byte
+            SSP2STATbits.D_nA = 1;
+            slave_interrupt();
+        }
+    }
+    slave_stop();
+    return 0;
+}
+
+/*
+ * Power-on state
+ */
+void host_reset(void){
+    memset(&host_state, 0, sizeof(host_state));
+    INTCON = 0; PIE1 = 0; PIE2 = 0; PCON0 = 0b00111100; SSP1STAT = 0; SSP1CON1 = 0; SSP2STAT = 0; SSP2CON1 = 0; SSP2CON3 = 0;
+    ADCON1 = 0; FVRCON = 0; T0CON0 = 0; T0CON1 = 0; T1CON = 0; T4CON = 0; T6CON = 0; PMD0 = 0; PMD4 = 0;
+    ANSELA = 0xff; ANSELB = 0xff; ANSELC = 0xff; TRISA = 0xff; TRISB = 0xff; TRISC = 0xff; LATA = 0; LATB = 0;
+    SSP1ADD = 0; SSP2ADD = 0; SSP2MSK = 0xff; PR4 = 0xff; PR6 = 0xff; ADRESH = 0; ADRESL = 0; nvmcon2 = 0;
+    PIR1_reg.byte = 0; PIR2_reg.byte = 0; SSP2CON2_reg.byte = 0; ADCON0_reg.byte = 0; NVMCON1_reg.byte = 0; LATC_reg.byte = 0; latc_seen = 0; ssp1buf = 0; ssp2buf = 0; tmr1 = 0;
+    ssp1_touched = false; ssp2_touched = false; master_writing = false; nvm_unlock_step = 0; nvm_unlocked = false;
+    in_idle = false; in_isr = false; booting = false;
+    for(unsigned char i = 0; i < 32; i++){
+        nvm_latches[i] = 0x3fff;
+    }
+    host_hooks.spi_exchange = default_spi_exchange;
+    host_hooks.adc_convert = default_adc_convert;
+    host_hooks.i2c_master_start = default_i2c_master_start;
+    host_hooks.i2c_master_write = default_i2c_master_write;
+    host_hooks.i2c_master_read = default_i2c_master_read;
+    host_hooks.i2c_master_stop = default_i2c_master_stop;
+    host_hooks.idle = 0;
+    host_hooks.chip_select = 0;
+    update_timers();
+}
+
+void host_boot(void){
+    booting = true;
+    if(setjmp(boot_exit) == 0){
+        esum_main();
+    }
+    booting = false;
+}
+
+void host_main_loop(void){//same order as the while(1) loop of main()
+    host_asm("CLRWDT");
+    Counter_Increment(CNT_loops);
+    Profile(SPI_Process, PRF_spi);
+    Profile(I2C_Process, PRF_i2c);
+    Profile(ADC_Process, PRF_adc);
+    Profile(Tracking_Process, PRF_bt);
+    Profile(Testpulser_Process, PRF_tp);
+    Profile(Misc_Process, PRF_misc);
+    Profile_Collect();
+    host_sync();
+}
@@ -0,0 +1,58 @@
+#ifndef HOST_HEADER
+#define	HOST_HEADER
+
+/*
+ * Host build of the EnergySum.X firmware: peripheral hooks, simulated time and an I2C master that drives the firmware's isr().
+ * Firmware time only passes in __delay_ms()/__delay_us(), SPI/ADC/I2C transfers and timer waits; nothing sleeps.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint8_t  (*spi_exchange)(uint8_t mosi);    //one MSSP1 byte; chip selects are in LATC (LATC0: offset DAC, LATC1: MDAC chain)
+    uint16_t (*adc_convert)(uint8_t channel);  //ADCON0.CHS -> 10-bit result
+    void     (*i2c_master_start)(void);        //MSSP2 in master mode (UID chip): start or repeated start
+    bool     (*i2c_master_write)(uint8_t data); //returns true on ACK
+    uint8_t  (*i2c_master_read)(void);
+    void     (*i2c_master_stop)(void);
+    void     (*idle)(uint32_t now_us);         //called whenever firmware time passes, e.g. to send I2C transactions while the firmware waits
+    void     (*chip_select)(uint8_t latc);     //LATC changed; seen at the next LATC access, SPI byte or host_sync()
+} host_hooks_t;
+
+typedef struct {
+    uint32_t time_us;       //firmware time
+    uint32_t resets;        //asm("RESET")
+    uint32_t clrwdt;        //asm("CLRWDT"), once per main loop iteration
+    uint32_t isr_calls;
+    uint32_t spi_bytes;
+    uint32_t adc_conversions;
+    uint32_t nvm_writes;    //erase or write operations started with NVMCON1.WR
+} host_state_t;
+
+extern host_hooks_t host_hooks;
+extern host_state_t host_state;
+extern uint16_t host_flash[0x2000]; //program flash words, written by the NVM model
+extern uint16_t host_user_id[4];    //0x8000-0x8003
+extern uint8_t host_uid[6];         //answer of the default UID chip model
+
+void host_reset(void);                  //all SFRs and models to their power-on state, default hooks
+void host_advance_us(uint32_t us);      //let firmware time pass (timers, idle hook)
+void host_boot(void);                   //runs main() of the firmware up to its main loop
+void host_main_loop(void);              //one iteration of the main loop
+void host_sync(void);                   //reports output changes the hooks have not seen yet (e.g. the last Set_CS(2))
+int host_i2c_write(uint8_t address, const uint8_t *data, uint8_t length);  //one write transaction to the MSSP2 slave; 0 on ACK, -1 on NACK
+int host_i2c_read(uint8_t address, uint8_t *data, uint8_t length);         //one read transaction
+
+//Firmware functions without a header
+void isr(void);
+void I2C_Process(void);
+void ADC_Process(void);
+void Tracking_Process(void);
+void Testpulser_Process(void);
+void Misc_Process(void);
+void Counters_Init(void);
+extern unsigned char memory[256];
+extern volatile unsigned char reset_counters[]; //reset_causes bytes
+
+#endif
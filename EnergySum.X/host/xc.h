@@ -0,0 +1,142 @@
+#ifndef HOST_XC_HEADER
+#define	HOST_XC_HEADER
+
+/*
+ * Host stand-in for XC8's <xc.h> (PIC16F18345), used by the host build in this directory only.
+ * SFRs are plain variables with the bit layout of the data sheet. Registers the firmware polls (SSP1BUF/SSP1IF, ADCON0.GO,
+ * SSP2 master mode, NVMCON1.WR, TMR4IF/TMR6IF) and LATC (SPI chip selects) are reached through accessor functions in host.c,
+ * which run the peripheral models (host_hooks in host.h) before the firmware sees the register.
+ */
+
+#include <stdint.h>
+
+#define __interrupt()
+#define __persistent
+#define __at(address)
+#define __delay_ms(x) host_delay_us((uint32_t)(x)*1000UL)
+#define __delay_us(x) host_delay_us((uint32_t)(x))
+#define asm(instruction) host_asm(instruction)
+
+void host_delay_us(uint32_t us);
+void host_asm(const char *instruction);
+
+/*
+ * XC8 also declares single bits (GIE, SSP2IF, ...), used both on their own and after "XXbits.". So that a bit macro
+ * (#define GIE INTCONbits.GIE) still works after the dot, every register union has a member with the name of its storage:
+ * INTCONbits.GIE -> INTCONbits.INTCONbits.GIE. Hooked registers keep their storage in XX_reg and are read through host_XX().
+ */
+#define HOST_SFR(name, fields) \
+    struct name##_fields { fields }; \
+    typedef union { struct { fields }; struct name##_fields name##bits; uint8_t byte; } name##bits_t; \
+    extern volatile name##bits_t name##bits;
+#define HOST_SFR_HOOKED(name, fields) \
+    struct name##_fields { fields }; \
+    typedef union { struct { fields }; struct name##_fields name##_reg; uint8_t byte; } name##bits_t; \
+    extern volatile name##bits_t name##_reg; \
+    volatile name##bits_t *host_##name(void);
+
+//Bit fields are listed from bit 0 upwards
+HOST_SFR(INTCON, unsigned INTEDG:1; unsigned :5; unsigned PEIE:1; unsigned GIE:1;)
+HOST_SFR_HOOKED(PIR1, unsigned TMR1IF:1; unsigned TMR2IF:1; unsigned BCL1IF:1; unsigned SSP1IF:1; unsigned TXIF:1; unsigned RCIF:1; unsigned ADIF:1; unsigned TMR1GIF:1;)
+HOST_SFR_HOOKED(PIR2, unsigned NCO1IF:1; unsigned TMR4IF:1; unsigned BCL2IF:1; unsigned SSP2IF:1; unsigned NVMIF:1; unsigned C1IF:1; unsigned C2IF:1; unsigned TMR6IF:1;)
+HOST_SFR(PIE1, unsigned TMR1IE:1; unsigned TMR2IE:1; unsigned BCL1IE:1; unsigned SSP1IE:1; unsigned TXIE:1; unsigned RCIE:1; unsigned ADIE:1; unsigned TMR1GIE:1;)
+HOST_SFR(PIE2, unsigned NCO1IE:1; unsigned TMR4IE:1; unsigned BCL2IE:1; unsigned SSP2IE:1; unsigned NVMIE:1; unsigned C1IE:1; unsigned C2IE:1; unsigned TMR6IE:1;)
+HOST_SFR(PCON0, unsigned nBOR:1; unsigned nPOR:1; unsigned nRI:1; unsigned nRMCLR:1; unsigned nRWDT:1; unsigned nWDTWV:1; unsigned STKUNF:1; unsigned STKOVF:1;)
+HOST_SFR(SSP1STAT, unsigned BF:1; unsigned UA:1; unsigned R_nW:1; unsigned S:1; unsigned P:1; unsigned D_nA:1; unsigned CKE:1; unsigned SMP:1;)
+HOST_SFR(SSP1CON1, unsigned SSPM:4; unsigned CKP:1; unsigned SSPEN:1; unsigned SSPOV:1; unsigned WCOL:1;)
+HOST_SFR(SSP2STAT, unsigned BF:1; unsigned UA:1; unsigned R_nW:1; unsigned S:1; unsigned P:1; unsigned D_nA:1; unsigned CKE:1; unsigned SMP:1;)
+HOST_SFR(SSP2CON1, unsigned SSPM:4; unsigned CKP:1; unsigned SSPEN:1; unsigned SSPOV:1; unsigned WCOL:1;)
+HOST_SFR_HOOKED(SSP2CON2, unsigned SEN:1; unsigned RSEN:1; unsigned PEN:1; unsigned RCEN:1; unsigned ACKEN:1; unsigned ACKDT:1; unsigned ACKSTAT:1; unsigned GCEN:1;)
+HOST_SFR(SSP2CON3, unsigned DHEN:1; unsigned AHEN:1; unsigned SBCDE:1; unsigned SDAHT:1; unsigned BOEN:1; unsigned SCIE:1; unsigned PCIE:1; unsigned ACKTIM:1;)
+HOST_SFR_HOOKED(ADCON0, unsigned ADON:1; unsigned GO:1; unsigned CHS:6;)
+HOST_SFR(ADCON1, unsigned ADPREF:2; unsigned ADNREF:1; unsigned :1; unsigned ADCS:3; unsigned ADFM:1;)
+HOST_SFR(FVRCON, unsigned ADFVR:2; unsigned CDAFVR:2; unsigned TSRNG:1; unsigned TSEN:1; unsigned FVRRDY:1; unsigned FVREN:1;)
+HOST_SFR_HOOKED(NVMCON1, unsigned RD:1; unsigned WR:1; unsigned WREN:1; unsigned WRERR:1; unsigned FREE:1; unsigned LWLO:1; unsigned NVMREGS:1; unsigned :1;)
+HOST_SFR(T0CON0, unsigned T0OUTPS:4; unsigned T016BIT:1; unsigned T0OUT:1; unsigned :1; unsigned T0EN:1;)
+HOST_SFR(T0CON1, unsigned T0CKPS:4; unsigned T0ASYNC:1; unsigned T0CS:3;)
+HOST_SFR(T1CON, unsigned TMR1ON:1; unsigned :1; unsigned nT1SYNC:1; unsigned T1SOSC:1; unsigned T1CKPS:2; unsigned TMR1CS:2;)
+HOST_SFR(T4CON, unsigned T4CKPS:2; unsigned TMR4ON:1; unsigned T4OUTPS:4; unsigned :1;)
+HOST_SFR(T6CON, unsigned T6CKPS:2; unsigned TMR6ON:1; unsigned T6OUTPS:4; unsigned :1;)
+HOST_SFR(PMD0, unsigned IOCMD:1; unsigned CLKRMD:1; unsigned NVMMD:1; unsigned :3; unsigned FVRMD:1; unsigned SYSCMD:1;)
+HOST_SFR(PMD4, unsigned CWG1MD:1; unsigned MSSP1MD:1; unsigned MSSP2MD:1; unsigned :2; unsigned UART1MD:1; unsigned :2;)
+HOST_SFR(ANSELA, unsigned ANSA0:1; unsigned ANSA1:1; unsigned ANSA2:1; unsigned :1; unsigned ANSA4:1; unsigned ANSA5:1; unsigned :2;)
+HOST_SFR(ANSELB, unsigned :4; unsigned ANSB4:1; unsigned ANSB5:1; unsigned ANSB6:1; unsigned ANSB7:1;)
+HOST_SFR(ANSELC, unsigned ANSC0:1; unsigned ANSC1:1; unsigned ANSC2:1; unsigned ANSC3:1; unsigned ANSC4:1; unsigned ANSC5:1; unsigned ANSC6:1; unsigned ANSC7:1;)
+HOST_SFR(TRISA, unsigned TRISA0:1; unsigned TRISA1:1; unsigned TRISA2:1; unsigned TRISA3:1; unsigned TRISA4:1; unsigned TRISA5:1; unsigned :2;)
+HOST_SFR(TRISB, unsigned :4; unsigned TRISB4:1; unsigned TRISB5:1; unsigned TRISB6:1; unsigned TRISB7:1;)
+HOST_SFR(TRISC, unsigned TRISC0:1; unsigned TRISC1:1; unsigned TRISC2:1; unsigned TRISC3:1; unsigned TRISC4:1; unsigned TRISC5:1; unsigned TRISC6:1; unsigned TRISC7:1;)
+HOST_SFR(LATA, unsigned LATA0:1; unsigned LATA1:1; unsigned LATA2:1; unsigned :1; unsigned LATA4:1; unsigned LATA5:1; unsigned :2;)
+HOST_SFR(LATB, unsigned :4; unsigned LATB4:1; unsigned LATB5:1; unsigned LATB6:1; unsigned LATB7:1;)
+HOST_SFR_HOOKED(LATC, unsigned LATC0:1; unsigned LATC1:1; unsigned LATC2:1; unsigned LATC3:1; unsigned LATC4:1; unsigned LATC5:1; unsigned LATC6:1; unsigned LATC7:1;)
+
+#define INTCON   INTCONbits.byte
+#define PIR1     (host_PIR1()->byte)
+#define PIR2     (host_PIR2()->byte)
+#define PIR1bits (*host_PIR1())
+#define PIR2bits (*host_PIR2())
+#define PIE1     PIE1bits.byte
+#define PIE2     PIE2bits.byte
+#define PCON0    PCON0bits.byte
+#define SSP1STAT SSP1STATbits.byte
+#define SSP1CON1 SSP1CON1bits.byte
+#define SSP2STAT SSP2STATbits.byte
+#define SSP2CON1 SSP2CON1bits.byte
+#define SSP2CON2 (host_SSP2CON2()->byte)
+#define SSP2CON2bits (*host_SSP2CON2())
+#define SSP2CON3 SSP2CON3bits.byte
+#define ADCON0   (host_ADCON0()->byte)
+#define ADCON0bits (*host_ADCON0())
+#define ADCON1   ADCON1bits.byte
+#define FVRCON   FVRCONbits.byte
+#define NVMCON1  (host_NVMCON1()->byte)
+#define NVMCON1bits (*host_NVMCON1())
+#define T0CON0   T0CON0bits.byte
+#define T0CON1   T0CON1bits.byte
+#define T1CON    T1CONbits.byte
+#define T4CON    T4CONbits.byte
+#define T6CON    T6CONbits.byte
+#define PMD0     PMD0bits.byte
+#define PMD4     PMD4bits.byte
+#define ANSELA   ANSELAbits.byte
+#define ANSELB   ANSELBbits.byte
+#define ANSELC   ANSELCbits.byte
+#define TRISA    TRISAbits.byte
+#define TRISB    TRISBbits.byte
+#define TRISC    TRISCbits.byte
+#define LATA     LATAbits.byte
+#define LATB     LATBbits.byte
+#define LATC     (host_LATC()->byte)
+#define LATCbits (*host_LATC())
+
+//Single bits that XC8 also declares on their own
+#define GIE      INTCONbits.GIE
+#define PEIE     INTCONbits.PEIE
+#define SSP2IE   PIE2bits.SSP2IE
+#define TMR4IE   PIE2bits.TMR4IE
+#define TMR6IE   PIE2bits.TMR6IE
+#define TMR4ON   T4CONbits.TMR4ON
+#define TMR6ON   T6CONbits.TMR6ON
+#define SSP1IF   PIR1bits.SSP1IF   //polled on its own: through the hook, so PIR1bits.SSP1IF can not be used
+#define TMR4IF   PIR2bits.TMR4IF   //same
+#define SSP2IF   PIR2_reg.SSP2IF   //only polled as PIR2bits.SSP2IF (master mode, hooked); on its own it is the plain bit
+
+//Buffers: the accessor notes that the firmware touched them (a write to SSP1BUF starts an SPI transfer, see host.c)
+volatile uint8_t *host_SSP1BUF(void);
+volatile uint8_t *host_SSP2BUF(void);
+#define SSP1BUF  (*host_SSP1BUF())
+#define SSP2BUF  (*host_SSP2BUF())
+volatile uint8_t *host_NVMCON2(void);
+#define NVMCON2  (*host_NVMCON2())
+volatile uint8_t *host_TMR1H(void);      //Timer1 runs on firmware time; writes are ignored
+volatile uint8_t *host_TMR1L(void);
+#define TMR1H    (*host_TMR1H())
+#define TMR1L    (*host_TMR1L())
+volatile uint8_t *host_TMR0L(void);      //Timer0 (16-bit, LFINTOSC): reading TMR0L latches TMR0H, as on the PIC
+volatile uint8_t *host_TMR0H(void);
+#define TMR0L    (*host_TMR0L())
+#define TMR0H    (*host_TMR0H())
+
+extern volatile uint8_t SSP1ADD, SSP2ADD, SSP2MSK, PPSLOCK, RC2PPS, RC3PPS, RC5PPS, RC6PPS, SSP1DATPPS, SSP2DATPPS, SSP2CLKPPS;
+extern volatile uint8_t ADRESH, ADRESL, NVMADRL, NVMADRH, NVMDATL, NVMDATH, PR4, PR6, TMR4, TMR6, STATUS;
+
+#endif
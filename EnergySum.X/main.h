@@ -37,6 +37,11 @@
  * 36:
  * 37:      I2C address flag (bit 0: if 1, i2c reinitializes with new I2C address)
  * 38:      I2C storage (set address here first, then set flag, see above, to update)
+ * 0x60-0x6a: baseline tracking (see BT_flag below); label "BLT" at 0x6c
+ * 0x70-0x96: counters (see CNT_flag below), read in one burst; label "CNT" at 0x7c
+ * 0x98-0x9a: general call and group address (see GRP_flag below); label "GRP" at 0x9c
+ * 0xa0-0xa2: command trace (see TRC_flag below); label "TRC" at 0xac
+ * 0xb0, 0xc0-0xfe: handler profiler (see PRF_flag below)
  * 100:     (arbitrary) used to empty global i2c address from SSP2BUF (memory[...] = SSP2BUF needed to clear SSP2BUF, BF flag etc.)
  */
 
@@ -54,14 +59,93 @@
 #define I2C_flag     0x53  //i2c flag, if bit 0 is 1, reinitializes i2c with address stored in memory[I2C_store]
 #define I2C_store    0x54  //i2c address can be modified here, and setting memory[I2C_flag] to 0b1 causes I2C get reinitialized with new address. IMPORTANT: check raspberry pi i2cdetect -y 1 function to see valid values!
 #define global_address_store 0x55 //i2c global address is written here, no particular use, only to clear SSP2BUF
+#define BT_flag      0x60  //baseline tracking flag, bit 0: keep baseline at baseline_ADC_value continuously by nudging the ODAC
+#define BT_deadband  0x61  //no correction while averaged reading is within baseline_ADC_value +- BT_deadband (ADC counts)
+#define BT_step      0x62  //max. change of ODAC code per correction
+#define BT_interval  0x63  //min. time between two corrections, in 10 ms ticks (see Timebase_Init())
+#define BT_limit     0x64  //max. |correction| in ODAC codes, 0: no limit
+#define BT_corr_MSB  0x65  //current correction (signed 16-bit, ODAC codes relative to code when tracking was started), BT_corr_MSB+1 is LSB
+#define BT_avg_MSB   0x67  //last averaged baseline ADC reading, BT_avg_MSB+1 is LSB
+#define BT_code_MSB  0x69  //ODAC code currently set while tracking (ODAC_MSB/LSB are not touched by tracking), BT_code_MSB+1 is LSB
+#define CNT_flag     0x70  //counters, bit 0: clear all counters. Counters are 16-bit (MSB first) and wrap around, except CNT_resets
+#define CNT_isr      0x71  //I2C interrupts
+#define CNT_rx       0x73  //bytes received as I2C slave, addresses included
+#define CNT_tx       0x75  //bytes sent as I2C slave
+#define CNT_loops    0x77  //main loop iterations
+#define CNT_wcol     0x79  //SSP1BUF writes repeated in SPI_IO_Byte() after a write collision
+#define CNT_spi      0x80  //commands executed by SPI_Process() (MDAC and ODAC flag bits)
+#define CNT_i2c      0x82  //                  I2C_Process() (slave address changes)
+#define CNT_adc      0x84  //                  ADC_Process() (measurements, baseline settings)
+#define CNT_bt       0x86  //                  Tracking_Process() (tracking steps)
+#define CNT_tp       0x88  //                  Testpulser_Process()
+#define CNT_misc     0x8a  //                  Misc_Process() (UID, LED)
+#define CNT_pcon     0x90  //PCON0 as found at the last start of the firmware, see Counters_Init()
+#define CNT_resets   0x91  //resets since power-up or brown-out by cause, 8-bit: power-on, brown-out (0 or 1), MCLR, watchdog, RESET instruction, stack
+#define GRP_flag     0x98  //bit 0: answer the general call address, bit 1: answer GRP_address; applied with I2C_flag like I2C_store
+#define GRP_address  0x99  //7-bit group address shared by several modules, see I2C_SlaveInit()
+#define GRP_apply    0x9a  //bit 0: write all MDACs (MDAC_flag bit 1), bit 1: write ODAC (ODAC_flag bit 0); meant to be sent to the group or general call (the only register it writes)
+#define TRC_flag     0xa0  //command trace, bit 0: clear the trace
+#define TRC_data     0xa2  //reading from here streams the trace[] ring buffer, oldest entry first (memory_address does not advance)
+#define PRF_flag     0xb0  //profiler (only built with profiler_enabled 1), bit 0: clear the table
+#define PRF_table    0xc0  //9 bytes per handler (PRF_isr, PRF_spi, ...): last, min, max duration, 24-bit MSB first, in instruction cycles (125 ns), saturating at 0xffffff
 
 #define version_register 0xff   //memory[] index
 
 #define version_number 0x07     //arbitrary (should be consequent) version number
 
+#ifndef profiler_enabled
+#define profiler_enabled 0      //1: Timer1 timestamps entry and exit of isr() and of each main loop handler, see PRF_flag
+#endif
+#define PRF_isr      0          //PRF_table rows
+#define PRF_spi      1
+#define PRF_i2c      2
+#define PRF_adc      3
+#define PRF_bt       4
+#define PRF_tp       5
+#define PRF_misc     6
+#define PRF_handlers 7
+
+/*
+ * trace[]: the last trace_entries host writes and command completions, 4 bytes each:
+ * [memory[] index, value, kind (bit 7) and time bits 14-8, time bits 7-0]
+ * kind 0: host write (isr()); kind 1: a handler finished the command of that flag register, value is the flag afterwards
+ * time: Timer0 on LFINTOSC/32, about 1 ms per count, 15 bits. Empty entries read 0xff 0xff 0xff 0xff.
+ */
+#define trace_entries 32
+#define trace_length (4*trace_entries) //power of 2
+
 #define i2c_default_address 0x2e        //7-bit i2c address assigned during power-on; should be 0x1e for level 1 ESUM module firmware, 0x2e for level 2 firmware
 
 extern unsigned char memory[256];
+extern unsigned char trace[trace_length];
+extern unsigned char trace_head;
+void Trace_Done(unsigned char flag);
+
+//group writes only reach the shadow configuration: MDAC values and ODAC value, sent to the DACs by GRP_apply. General call writes only reach GRP_apply.
+#define Group_Writable(index) ((index) < MDAC_flag || (index) == ODAC_MSB || (index) == ODAC_LSB || (index) == GRP_apply)
+
+#define Counter_Increment(index) do{ if(++memory[(index)+1] == 0){ memory[index]++; } }while(0) //inline, also used in isr()
+
+//inline for isr(); TMR0L first, it latches TMR0H
+#define Trace(index, value, kind) do{ unsigned char trace_time = TMR0L; trace[trace_head] = (index); trace[trace_head + 1] = (value); \
+    trace[trace_head + 2] = (TMR0H & 0x7f) | (kind); trace[trace_head + 3] = trace_time; trace_head = (trace_head + 4) & (trace_length - 1); }while(0)
+#define trace_write 0x00
+#define trace_done  0x80
+
+#if profiler_enabled
+#define Profile(handler, row) do{ uint32_t profile_start = Profiler_Now(); handler(); Profiler_Record(row, profile_start); }while(0)
+//inline for isr(): 8/16-bit latches only, Profiler_Isr() records them from the main loop. An isr() is far below 65536 cycles (8 ms)
+#define Profile_Latch(ticks) do{ unsigned char profile_high = TMR1H; (ticks) = TMR1L; \
+    if(profile_high != TMR1H){ profile_high = TMR1H; (ticks) = TMR1L; } (ticks) |= (uint16_t)profile_high << 8; }while(0) //TMR1L rolled over between the reads
+#define Profile_Enter() uint16_t profile_start; Profile_Latch(profile_start)
+#define Profile_Exit() do{ if(!profiler_isr_pending){ Profile_Latch(profiler_isr_ticks); profiler_isr_ticks -= profile_start; profiler_isr_pending = 1; } }while(0)
+#define Profile_Collect() Profiler_Isr()
+#else
+#define Profile(handler, row) handler()
+#define Profile_Enter()
+#define Profile_Exit()
+#define Profile_Collect()
+#endif
 
 #endif
 
@@ -75,6 +159,7 @@ extern unsigned char memory[256];
  *      i)   in main.h: i2c_default_address 0x2e
  *      ii)  in MDAC.h: daisy_chain_length  4
  *  3. Check version_number. If there have been significant notifications, increment by one.
+ *  4. profiler_enabled 1 in main.h adds the handler profiler (PRF_flag); leave it at 0 for production firmware.
  * 
  * If a hex fuke us nade fir uploading to a module, make sure the following are set (right click on project folder -> set configuration -> custom):
  * XC8 linker:  Runtime: Format hex file for download